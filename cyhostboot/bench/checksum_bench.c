@@ -0,0 +1,132 @@
+/*
+ * Compare the packet checksum functions against the original bit by bit
+ * implementations, both for results and speed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <cybtldr_checksum.h>
+
+/* Run each measure for at least this time, in nanoseconds */
+#define BENCH_MIN_TIME		200000000ULL
+#define CHECK_MAX_SIZE		1024
+
+static const unsigned long bench_sizes[] = {7, 64, 139, 512, 4096};
+
+static unsigned short ref_sum_checksum(const unsigned char *buf, unsigned long size)
+{
+	unsigned short sum = 0;
+
+	while (size-- > 0)
+		sum += *buf++;
+
+	return (1 + ~sum);
+}
+
+static unsigned short ref_crc_checksum(const unsigned char *buf, unsigned long size)
+{
+	unsigned short crc = 0xffff;
+	unsigned short tmp;
+	int i;
+
+	if (size == 0)
+		return (~crc);
+
+	do {
+		for (i = 0, tmp = 0x00ff & *buf++; i < 8; i++, tmp >>= 1) {
+			if ((crc & 0x0001) ^ (tmp & 0x0001))
+				crc = (crc >> 1) ^ 0x8408;
+			else
+				crc >>= 1;
+		}
+	} while (--size);
+
+	crc = ~crc;
+	tmp = crc;
+	crc = (crc << 8) | (tmp >> 8 & 0xFF);
+
+	return crc;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Return the mean time of a call in nanoseconds
+ */
+static double bench(CyBtldr_ChecksumFunc *func, const unsigned char *buf, unsigned long size)
+{
+	unsigned long long start, elapsed, iterations = 0, batch = 1024, i;
+	volatile unsigned short sink = 0;
+
+	start = now_ns();
+	do {
+		for (i = 0; i < batch; i++)
+			sink += func(buf + (i & 7), size);
+		iterations += batch;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_MIN_TIME);
+	(void) sink;
+
+	return (double) elapsed / iterations;
+}
+
+static int check(const char *name, CyBtldr_ChecksumFunc *ref, CyBtldr_ChecksumFunc *func,
+		 const unsigned char *buf)
+{
+	unsigned long size, offset;
+
+	/* Cover all tail lengths and misalignments */
+	for (size = 0; size <= CHECK_MAX_SIZE; size++) {
+		for (offset = 0; offset < 16; offset++) {
+			if (ref(buf + offset, size) != func(buf + offset, size)) {
+				printf("%s mismatch for size %lu, offset %lu: 0x%04x != 0x%04x\n", name,
+				       size, offset, ref(buf + offset, size), func(buf + offset, size));
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void compare(const char *name, CyBtldr_ChecksumFunc *ref, CyBtldr_ChecksumFunc *func,
+		    const unsigned char *buf)
+{
+	unsigned int i;
+	double ref_ns, func_ns;
+
+	for (i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+		ref_ns = bench(ref, buf, bench_sizes[i]);
+		func_ns = bench(func, buf, bench_sizes[i]);
+		printf("%-4s %6lu bytes: reference %9.1f ns (%7.1f MB/s), new %9.1f ns (%7.1f MB/s), x%.1f\n",
+		       name, bench_sizes[i], ref_ns, bench_sizes[i] * 1e3 / ref_ns,
+		       func_ns, bench_sizes[i] * 1e3 / func_ns, ref_ns / func_ns);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char buf[4096 + CHECK_MAX_SIZE + 16];
+	unsigned int i;
+
+	srand(1);
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = rand();
+
+	if (check("sum", ref_sum_checksum, CyBtldr_SumChecksum, buf) ||
+	    check("crc", ref_crc_checksum, CyBtldr_CrcChecksum, buf))
+		return 1;
+	printf("Checksums match the reference for sizes up to %d bytes\n", CHECK_MAX_SIZE);
+
+	compare("sum", ref_sum_checksum, CyBtldr_SumChecksum, buf);
+	compare("crc", ref_crc_checksum, CyBtldr_CrcChecksum, buf);
+
+	return 0;
+}
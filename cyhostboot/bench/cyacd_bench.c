@@ -0,0 +1,228 @@
+/*
+ * Compare the mapped cyacd image loader against line by line stdio parsing
+ * on a synthetic corpus, and the hex decoders against each other.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cybtldr_parse.h>
+#include <cybtldr_hex.h>
+
+#define DEFAULT_FILE_COUNT	1000
+#define ROW_COUNT		256
+#define ROW_SIZE		128
+#define HEX_BENCH_SIZE		(1024 * 1024)
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_cyacd(const char *path)
+{
+	unsigned char row[5 + ROW_SIZE];
+	unsigned char sum;
+	unsigned int i, j;
+	FILE *file;
+
+	file = fopen(path, "w");
+	if (!file)
+		return 1;
+
+	fprintf(file, "04C8119311%02X\r\n", 0);
+	for (i = 0; i < ROW_COUNT; i++) {
+		row[0] = 0;
+		row[1] = i >> 8;
+		row[2] = i;
+		row[3] = ROW_SIZE >> 8;
+		row[4] = ROW_SIZE & 0xff;
+		sum = 0;
+		fputc(':', file);
+		for (j = 0; j < sizeof(row); j++) {
+			if (j >= 5)
+				row[j] = rand();
+			sum += row[j];
+			fprintf(file, "%02X", row[j]);
+		}
+		fprintf(file, "%02X\r\n", (unsigned char) -sum);
+	}
+
+	return fclose(file) != 0;
+}
+
+/**
+ * Load a file the way it was done before images were mapped: one fgets()
+ * and CyBtldr_ParseRowData() per line, copied to the image storage.
+ */
+static int ref_load_image(const char *path, CyBtldr_Image *image)
+{
+	char line[MAX_BUFFER_SIZE];
+	unsigned char buffer[MAX_BUFFER_SIZE];
+	unsigned char chksum = SUM_CHECKSUM, sum;
+	unsigned int len, i, size = 0, count = 0;
+	CyBtldr_Row *row;
+	int err = CYRET_SUCCESS;
+	FILE *file;
+
+	memset(image, 0, sizeof(*image));
+	file = fopen(path, "r");
+	if (!file)
+		return CYRET_ERR_FILE;
+
+	image->rows = malloc(ROW_COUNT * sizeof(CyBtldr_Row));
+	image->data = malloc(ROW_COUNT * ROW_SIZE);
+	while (err == CYRET_SUCCESS && fgets(line, sizeof(line), file)) {
+		len = strlen(line);
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			len--;
+		if (count++ == 0) {
+			err = CyBtldr_ParseHeader(len, (unsigned char *) line, &image->siliconId,
+						  &image->siliconRev, &chksum);
+			continue;
+		}
+		row = &image->rows[image->rowCount];
+		err = CyBtldr_ParseRowData(len, (unsigned char *) line, &row->arrayId, &row->rowNum,
+					   buffer, &row->size, &row->checksum);
+		if (err != CYRET_SUCCESS || image->rowCount == ROW_COUNT)
+			break;
+		sum = row->arrayId + row->rowNum + (row->rowNum >> 8) + row->size + (row->size >> 8) + row->checksum;
+		for (i = 0; i < row->size; i++)
+			sum += buffer[i];
+		if (sum)
+			err = CYRET_ERR_CHECKSUM;
+		row->data = image->data + size;
+		memcpy(row->data, buffer, row->size);
+		size += row->size;
+		image->rowCount++;
+	}
+	fclose(file);
+
+	return err;
+}
+
+static int same_image(const CyBtldr_Image *a, const CyBtldr_Image *b)
+{
+	unsigned int i;
+
+	if (a->rowCount != b->rowCount || a->siliconId != b->siliconId)
+		return 0;
+	for (i = 0; i < a->rowCount; i++) {
+		if (a->rows[i].rowNum != b->rows[i].rowNum || a->rows[i].size != b->rows[i].size ||
+		    a->rows[i].checksum != b->rows[i].checksum ||
+		    memcmp(a->rows[i].data, b->rows[i].data, a->rows[i].size))
+			return 0;
+	}
+
+	return 1;
+}
+
+static double bench_corpus(const char *name, int (*load)(const char *, CyBtldr_Image *),
+			   char **paths, int count)
+{
+	unsigned long long start, elapsed;
+	CyBtldr_Image image;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < count; i++) {
+		if (load(paths[i], &image) != CYRET_SUCCESS) {
+			printf("%s: failed to load %s\n", name, paths[i]);
+			exit(1);
+		}
+		CyBtldr_FreeImage(&image);
+	}
+	elapsed = now_ns() - start;
+	printf("%-6s %d files: %8.1f ms, %7.1f us per file\n", name, count,
+	       elapsed / 1e6, elapsed / 1e3 / count);
+
+	return elapsed;
+}
+
+static double bench_hex(const char *name, CyBtldr_HexDecodeFunc *decode,
+			const char *hex, unsigned char *data)
+{
+	unsigned long long start, elapsed;
+	int i, iterations = 100;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		decode(hex, HEX_BENCH_SIZE, data);
+	elapsed = now_ns() - start;
+	printf("%-6s hex decode: %8.1f MB/s\n", name,
+	       (double) HEX_BENCH_SIZE * iterations * 1e3 / elapsed);
+
+	return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/cyacd_bench.XXXXXX";
+	int i, count = argc > 1 ? atoi(argv[1]) : DEFAULT_FILE_COUNT;
+	CyBtldr_Image ref, image;
+	unsigned char *ref_data, *data;
+	double ref_time, time;
+	char **paths, *hex;
+	int ret = 0;
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	srand(1);
+	paths = calloc(count, sizeof(char *));
+	for (i = 0; i < count; i++) {
+		paths[i] = malloc(sizeof(dir) + 32);
+		sprintf(paths[i], "%s/%d.cyacd", dir, i);
+		if (write_cyacd(paths[i])) {
+			printf("Failed to write %s\n", paths[i]);
+			ret = 1;
+			count = i + 1;
+			goto out;
+		}
+	}
+
+	if (ref_load_image(paths[0], &ref) != CYRET_SUCCESS ||
+	    CyBtldr_LoadImage(paths[0], &image) != CYRET_SUCCESS || !same_image(&ref, &image)) {
+		printf("Loaded images differ\n");
+		ret = 1;
+		goto out;
+	}
+	CyBtldr_FreeImage(&ref);
+	CyBtldr_FreeImage(&image);
+
+	/* First pass warms the page cache */
+	bench_corpus("stdio", ref_load_image, paths, count);
+	ref_time = bench_corpus("stdio", ref_load_image, paths, count);
+	time = bench_corpus("mmap", CyBtldr_LoadImage, paths, count);
+	printf("mmap loader speedup: x%.1f\n\n", ref_time / time);
+
+	hex = malloc(2 * HEX_BENCH_SIZE);
+	ref_data = malloc(HEX_BENCH_SIZE);
+	data = malloc(HEX_BENCH_SIZE);
+	for (i = 0; i < 2 * HEX_BENCH_SIZE; i++)
+		hex[i] = "0123456789ABCDEFabcdef"[rand() % 22];
+	if (CyBtldr_HexDecodeScalar(hex, HEX_BENCH_SIZE, ref_data) != CYRET_SUCCESS ||
+	    CyBtldr_HexDecode(hex, HEX_BENCH_SIZE, data) != CYRET_SUCCESS ||
+	    memcmp(ref_data, data, HEX_BENCH_SIZE)) {
+		printf("Hex decoders differ\n");
+		ret = 1;
+		goto out;
+	}
+	ref_time = bench_hex("scalar", CyBtldr_HexDecodeScalar, hex, ref_data);
+	time = bench_hex("simd", CyBtldr_HexDecode, hex, data);
+	printf("simd hex decode speedup: x%.1f\n", ref_time / time);
+
+out:
+	for (i = 0; i < count; i++)
+		unlink(paths[i]);
+	rmdir(dir);
+
+	return ret;
+}
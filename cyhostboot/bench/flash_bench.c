@@ -0,0 +1,335 @@
+/*
+ * End to end flash benchmark: program, verify and erase synthetic images on
+ * the bootloader simulator through the serial transport, at several
+ * simulated baudrates, and report the total time, throughput and the latency
+ * of each command type.
+ *
+ * Usage: flash_bench <cybtldrsim> [results.json]
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <cybtldr_api2.h>
+#include <cybtldr_command.h>
+
+#include "../src/serial.h"
+
+#define ROW_SIZE		128
+#define HOST_BAUDRATE		115200
+#define TIMEOUT_MS		1000
+#define CMD_FIRST		CMD_VERIFY_CHECKSUM
+#define CMD_COUNT		(CMD_EXIT_BOOTLOADER - CMD_FIRST + 1)
+
+/* Baudrates simulated by cybtldrsim, 0 to answer as fast as possible */
+static const unsigned int bench_baudrates[] = {115200, 921600, 0};
+static const unsigned int bench_rows[] = {32, 128};
+static const struct {
+	CyBtldr_Action action;
+	const char *name;
+} bench_actions[] = {
+	{PROGRAM, "program"},
+	{VERIFY, "verify"},
+	{ERASE, "erase"},
+};
+
+struct cmd_stats {
+	unsigned long count;
+	/* Latency of each command answered, from write to complete response */
+	unsigned long long *samples;
+	unsigned long nsamples;
+	unsigned long size;
+};
+
+/*
+ * Serial port wrapped to time the commands: the port must stay the first
+ * member as the context is passed untouched to the serial functions.
+ */
+struct bench_link {
+	struct serial_port port;
+	unsigned char cmd;
+	unsigned long long start;
+	struct cmd_stats stats[CMD_COUNT];
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_write(void *ctx, unsigned char *bytes, int size)
+{
+	struct bench_link *link = ctx;
+
+	link->cmd = bytes[1];
+	link->start = now_ns();
+	if (link->cmd >= CMD_FIRST && link->cmd - CMD_FIRST < CMD_COUNT)
+		link->stats[link->cmd - CMD_FIRST].count++;
+
+	return serial_write(&link->port, bytes, size);
+}
+
+static int bench_read(void *ctx, unsigned char *bytes, int size)
+{
+	struct bench_link *link = ctx;
+	struct cmd_stats *stats;
+	int ret;
+
+	ret = serial_read(&link->port, bytes, size);
+	if (ret != CYRET_SUCCESS || link->cmd < CMD_FIRST || link->cmd - CMD_FIRST >= CMD_COUNT)
+		return ret;
+
+	stats = &link->stats[link->cmd - CMD_FIRST];
+	if (stats->nsamples == stats->size) {
+		stats->size = stats->size ? stats->size * 2 : 64;
+		stats->samples = realloc(stats->samples, stats->size * sizeof(*stats->samples));
+	}
+	stats->samples[stats->nsamples++] = now_ns() - link->start;
+
+	return ret;
+}
+
+static void reset_stats(struct bench_link *link)
+{
+	int i;
+
+	for (i = 0; i < CMD_COUNT; i++) {
+		link->stats[i].count = 0;
+		link->stats[i].nsamples = 0;
+	}
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted samples, in microseconds */
+static double percentile_us(const struct cmd_stats *stats, unsigned int pct)
+{
+	unsigned long rank = (stats->nsamples * pct + 99) / 100;
+
+	return stats->samples[rank ? rank - 1 : 0] / 1000.0;
+}
+
+static int write_cyacd(const char *path, unsigned int rows)
+{
+	unsigned char row[5 + ROW_SIZE];
+	unsigned char sum;
+	unsigned int i, j;
+	FILE *file;
+
+	file = fopen(path, "w");
+	if (!file)
+		return 1;
+
+	fprintf(file, "04C8119311%02X\r\n", SUM_CHECKSUM);
+	for (i = 0; i < rows; i++) {
+		row[0] = 0;
+		row[1] = i >> 8;
+		row[2] = i;
+		row[3] = ROW_SIZE >> 8;
+		row[4] = ROW_SIZE & 0xff;
+		sum = 0;
+		fputc(':', file);
+		for (j = 0; j < sizeof(row); j++) {
+			if (j >= 5)
+				row[j] = rand();
+			sum += row[j];
+			fprintf(file, "%02X", row[j]);
+		}
+		fprintf(file, "%02X\r\n", (unsigned char) -sum);
+	}
+
+	return fclose(file) != 0;
+}
+
+static pid_t start_sim(const char *sim, const char *link, unsigned int baudrate)
+{
+	char baudrate_str[16];
+	struct stat st;
+	pid_t pid;
+	int i, fd;
+
+	snprintf(baudrate_str, sizeof(baudrate_str), "%u", baudrate);
+	unlink(link);
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		execl(sim, sim, "-l", link, "-b", baudrate_str, (char *)NULL);
+		_exit(127);
+	}
+
+	for (i = 0; i < 100; i++) {
+		if (lstat(link, &st) == 0)
+			return pid;
+		usleep(20000);
+	}
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+
+	return -1;
+}
+
+static void stop_sim(pid_t pid)
+{
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+/* serial_open() reports the parity on stdout, keep it out of the results */
+static int run_action(CyBtldr_Session *session, CyBtldr_Action action, const char *file)
+{
+	int saved, fd, ret;
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	fd = open("/dev/null", O_WRONLY);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	ret = CyBtldr_RunAction(session, action, file, NULL, 1, NULL);
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	return ret;
+}
+
+static void report(FILE *json, struct bench_link *link, const char *action, unsigned int baudrate,
+		   unsigned int rows, double wall, int ret, int first)
+{
+	unsigned long bytes = rows * ROW_SIZE;
+	struct cmd_stats *stats;
+	const char *name;
+	int i, n = 0;
+
+	printf("%-8s %8u %5u %9.3f %10.0f %s\n", action, baudrate, rows, wall,
+	       bytes / wall, ret == CYRET_SUCCESS ? "OK" : "FAILED");
+
+	fprintf(json, "%s\n    {\"action\": \"%s\", \"baudrate\": %u, \"rows\": %u, "
+		"\"bytes\": %lu, \"wall_s\": %.6f, \"bytes_per_s\": %.1f, \"result\": %d,\n"
+		"     \"commands\": {", first ? "" : ",", action, baudrate, rows, bytes,
+		wall, bytes / wall, ret);
+
+	for (i = 0; i < CMD_COUNT; i++) {
+		stats = &link->stats[i];
+		if (!stats->count)
+			continue;
+		name = CyBtldr_GetCommandName(CMD_FIRST + i);
+		fprintf(json, "%s\n       \"%s\": {\"count\": %lu", n++ ? "," : "",
+			name, stats->count);
+		if (stats->nsamples) {
+			qsort(stats->samples, stats->nsamples, sizeof(*stats->samples), cmp_ull);
+			printf("    %-16s %6lu  p50 %9.1f us  p99 %9.1f us\n", name, stats->count,
+			       percentile_us(stats, 50), percentile_us(stats, 99));
+			fprintf(json, ", \"p50_us\": %.1f, \"p99_us\": %.1f",
+				percentile_us(stats, 50), percentile_us(stats, 99));
+		} else {
+			printf("    %-16s %6lu\n", name, stats->count);
+		}
+		fprintf(json, "}");
+	}
+	fprintf(json, "}}");
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = argc > 2 ? argv[2] : "flash_bench.json";
+	char dir[] = "/tmp/flash_bench.XXXXXX";
+	char tty[64], file[64];
+	CyBtldr_CommunicationsData comms;
+	CyBtldr_Session session;
+	struct bench_link link;
+	unsigned long long start;
+	unsigned int b, r, a, i;
+	int ret, failed = 0, first = 1;
+	FILE *json;
+	pid_t pid;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <cybtldrsim> [results.json]\n", argv[0]);
+		return 1;
+	}
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(tty, sizeof(tty), "%s/tty", dir);
+	snprintf(file, sizeof(file), "%s/image.cyacd", dir);
+
+	json = fopen(output, "w");
+	if (!json) {
+		perror(output);
+		return 1;
+	}
+	fprintf(json, "{\n  \"benchmark\": \"flash\",\n  \"row_size\": %d,\n"
+		"  \"transfer_size\": %d,\n  \"results\": [", ROW_SIZE, SERIAL_TRANSFER_SIZE);
+
+	memset(&link, 0, sizeof(link));
+	serial_init(&link.port, tty, HOST_BAUDRATE, SERIAL_PARITY_NONE, TIMEOUT_MS);
+	serial_init_comms(&link.port, &comms);
+	comms.ReadData = bench_read;
+	comms.WriteData = bench_write;
+	comms.Context = &link;
+
+	printf("%-8s %8s %5s %9s %10s\n", "action", "baudrate", "rows", "time (s)", "bytes/s");
+	for (b = 0; b < sizeof(bench_baudrates) / sizeof(bench_baudrates[0]); b++) {
+		pid = start_sim(argv[1], tty, bench_baudrates[b]);
+		if (pid < 0) {
+			fprintf(stderr, "Can not start %s\n", argv[1]);
+			failed = 1;
+			break;
+		}
+
+		for (r = 0; r < sizeof(bench_rows) / sizeof(bench_rows[0]); r++) {
+			if (write_cyacd(file, bench_rows[r])) {
+				perror(file);
+				failed = 1;
+				break;
+			}
+			for (a = 0; a < sizeof(bench_actions) / sizeof(bench_actions[0]); a++) {
+				CyBtldr_InitSession(&session, &comms);
+				reset_stats(&link);
+				start = now_ns();
+				ret = run_action(&session, bench_actions[a].action, file);
+				report(json, &link, bench_actions[a].name, bench_baudrates[b],
+				       bench_rows[r], (now_ns() - start) / 1e9, ret, first);
+				first = 0;
+				failed |= ret != CYRET_SUCCESS;
+			}
+		}
+
+		stop_sim(pid);
+	}
+	fprintf(json, "\n  ]\n}\n");
+	fclose(json);
+
+	for (i = 0; i < CMD_COUNT; i++)
+		free(link.stats[i].samples);
+	unlink(file);
+	unlink(tty);
+	rmdir(dir);
+
+	printf("Results written to %s\n", output);
+
+	return failed;
+}
@@ -0,0 +1,281 @@
+/*
+ * Gang programming benchmark: program a synthetic image on several
+ * bootloader simulators at once with cyhostboot, through the epoll and the
+ * io_uring transports, and report the system calls made per row and the CPU
+ * time used per board. System calls are counted by tracing cyhostboot with
+ * ptrace in a second run, so that the tracing does not skew the CPU time.
+ *
+ * Usage: gang_bench <cyhostboot> <cybtldrsim> [results.json]
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <cybtldr_api.h>
+
+#define ROW_SIZE		128
+#define ROWS			64
+#define MAX_BOARDS		16
+
+/* Baudrates simulated by cybtldrsim, 0 to answer as fast as possible */
+static const unsigned int bench_baudrates[] = {921600, 0};
+static const unsigned int bench_boards[] = {1, 4, MAX_BOARDS};
+static const char *const bench_transports[] = {"epoll", "io_uring"};
+
+struct run_result {
+	double wall;
+	double cpu;
+	unsigned long syscalls;
+	int status;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_cyacd(const char *path, unsigned int rows)
+{
+	unsigned char row[5 + ROW_SIZE];
+	unsigned char sum;
+	unsigned int i, j;
+	FILE *file;
+
+	file = fopen(path, "w");
+	if (!file)
+		return 1;
+
+	fprintf(file, "04C8119311%02X\r\n", SUM_CHECKSUM);
+	for (i = 0; i < rows; i++) {
+		row[0] = 0;
+		row[1] = i >> 8;
+		row[2] = i;
+		row[3] = ROW_SIZE >> 8;
+		row[4] = ROW_SIZE & 0xff;
+		sum = 0;
+		fputc(':', file);
+		for (j = 0; j < sizeof(row); j++) {
+			if (j >= 5)
+				row[j] = rand();
+			sum += row[j];
+			fprintf(file, "%02X", row[j]);
+		}
+		fprintf(file, "%02X\r\n", (unsigned char) -sum);
+	}
+
+	return fclose(file) != 0;
+}
+
+static pid_t start_sim(const char *sim, const char *link, unsigned int baudrate)
+{
+	char baudrate_str[16];
+	struct stat st;
+	pid_t pid;
+	int i, fd;
+
+	snprintf(baudrate_str, sizeof(baudrate_str), "%u", baudrate);
+	unlink(link);
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		execl(sim, sim, "-l", link, "-b", baudrate_str, (char *)NULL);
+		_exit(127);
+	}
+
+	for (i = 0; i < 100; i++) {
+		if (lstat(link, &st) == 0)
+			return pid;
+		usleep(20000);
+	}
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+
+	return -1;
+}
+
+static void stop_sim(pid_t pid)
+{
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+/* Count the system calls of a traced child until it exits */
+static int count_syscalls(pid_t pid, unsigned long *syscalls)
+{
+	unsigned long stops = 0;
+	int status, sig;
+
+	/* Stopped by itself before exec */
+	if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status))
+		return -1;
+	ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+
+	sig = 0;
+	while (ptrace(PTRACE_SYSCALL, pid, 0, sig) == 0) {
+		if (waitpid(pid, &status, 0) < 0)
+			return -1;
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+			break;
+		sig = 0;
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+			stops++;
+		else if (WSTOPSIG(status) != SIGTRAP)
+			sig = WSTOPSIG(status);
+	}
+	/* Each system call stops on entry and on exit */
+	*syscalls = stops / 2;
+
+	return status;
+}
+
+static int run_host(const char *host, const char *file, char ttys[][64], unsigned int boards,
+		    int uring, int traced, struct run_result *result)
+{
+	char *argv[4 + 2 * MAX_BOARDS + 2];
+	unsigned long long start;
+	struct rusage usage;
+	unsigned int i;
+	int argc = 0, fd, status;
+	pid_t pid;
+
+	argv[argc++] = (char *)host;
+	argv[argc++] = "-f";
+	argv[argc++] = (char *)file;
+	for (i = 0; i < boards; i++) {
+		argv[argc++] = "-s";
+		argv[argc++] = ttys[i];
+	}
+	if (uring)
+		argv[argc++] = "--io_uring";
+	argv[argc] = NULL;
+
+	start = now_ns();
+	pid = fork();
+	if (pid < 0)
+		return 1;
+	if (pid == 0) {
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		if (traced) {
+			ptrace(PTRACE_TRACEME, 0, 0, 0);
+			raise(SIGSTOP);
+		}
+		execv(host, argv);
+		_exit(127);
+	}
+
+	if (traced) {
+		status = count_syscalls(pid, &result->syscalls);
+		waitpid(pid, NULL, 0);
+	} else if (wait4(pid, &status, 0, &usage) < 0) {
+		status = -1;
+	} else {
+		result->wall = (now_ns() - start) / 1e9;
+		result->cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+			      usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	}
+	if (status < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		result->status = 1;
+
+	return result->status;
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = argc > 3 ? argv[3] : "gang_bench.json";
+	char dir[] = "/tmp/gang_bench.XXXXXX";
+	char ttys[MAX_BOARDS][64], file[64];
+	pid_t pids[MAX_BOARDS];
+	struct run_result result;
+	unsigned int r, b, t, i, boards, rows;
+	int failed = 0, first = 1;
+	FILE *json;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <cyhostboot> <cybtldrsim> [results.json]\n", argv[0]);
+		return 1;
+	}
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(file, sizeof(file), "%s/image.cyacd", dir);
+	if (write_cyacd(file, ROWS)) {
+		perror(file);
+		return 1;
+	}
+
+	json = fopen(output, "w");
+	if (!json) {
+		perror(output);
+		return 1;
+	}
+	fprintf(json, "{\n  \"benchmark\": \"gang\",\n  \"row_size\": %d,\n  \"rows\": %d,\n"
+		"  \"results\": [", ROW_SIZE, ROWS);
+
+	printf("%-9s %8s %6s %9s %14s %13s\n", "transport", "baudrate", "boards", "time (s)",
+	       "CPU/board (ms)", "syscalls/row");
+	for (r = 0; r < sizeof(bench_baudrates) / sizeof(bench_baudrates[0]) && !failed; r++) {
+		for (b = 0; b < sizeof(bench_boards) / sizeof(bench_boards[0]) && !failed; b++) {
+			boards = bench_boards[b];
+			rows = ROWS * boards;
+			for (i = 0; i < boards; i++) {
+				snprintf(ttys[i], sizeof(ttys[i]), "%s/tty%u", dir, i);
+				pids[i] = start_sim(argv[2], ttys[i], bench_baudrates[r]);
+				if (pids[i] < 0) {
+					fprintf(stderr, "Can not start %s\n", argv[2]);
+					boards = i;
+					failed = 1;
+					break;
+				}
+			}
+
+			for (t = 0; t < sizeof(bench_transports) / sizeof(bench_transports[0]) && !failed; t++) {
+				memset(&result, 0, sizeof(result));
+				failed |= run_host(argv[1], file, ttys, boards, t, 0, &result);
+				failed |= run_host(argv[1], file, ttys, boards, t, 1, &result);
+
+				printf("%-9s %8u %6u %9.3f %14.2f %13.1f %s\n", bench_transports[t],
+				       bench_baudrates[r], boards, result.wall, result.cpu * 1000 / boards,
+				       (double)result.syscalls / rows, result.status ? "FAILED" : "OK");
+				fprintf(json, "%s\n    {\"transport\": \"%s\", \"baudrate\": %u, \"boards\": %u, "
+					"\"wall_s\": %.6f, \"cpu_ms_per_board\": %.3f, \"syscalls\": %lu, "
+					"\"syscalls_per_row\": %.2f, \"result\": %d}", first ? "" : ",",
+					bench_transports[t], bench_baudrates[r], boards, result.wall,
+					result.cpu * 1000 / boards, result.syscalls,
+					(double)result.syscalls / rows, result.status);
+				first = 0;
+			}
+
+			for (i = 0; i < boards; i++) {
+				stop_sim(pids[i]);
+				unlink(ttys[i]);
+			}
+		}
+	}
+	fprintf(json, "\n  ]\n}\n");
+	fclose(json);
+
+	unlink(file);
+	rmdir(dir);
+
+	printf("Results written to %s\n", output);
+
+	return failed;
+}
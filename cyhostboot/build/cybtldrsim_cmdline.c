@@ -0,0 +1,146 @@
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "cybtldrsim_cmdline.h"
+int cybtldrsim_cmdline_parser(int argc, char **argv, struct cybtldrsim_args_info *a)
+{
+  memset(a, 0, sizeof(*a));
+  a->silicon_id_arg = strdup("0x04C81193");
+  a->silicon_rev_arg = strdup("0x11");
+  a->bl_version_arg = strdup("0x010300");
+  a->arrays_arg = 1;
+  a->first_row_arg = 0;
+  a->last_row_arg = 255;
+  a->row_size_arg = 128;
+  a->buffer_size_arg = 512;
+  a->write_latency_arg = 0;
+  a->baudrate_arg = 0;
+  a->crc_flag = 0;
+  a->multi_app_flag = 0;
+  a->drop_arg = 0;
+  a->verbose_flag = 0;
+  static struct option lo[] = {
+    {"link", 1, 0, 1000},
+    {"tcp", 1, 0, 1001},
+    {"uhid", 1, 0, 1002},
+    {"silicon_id", 1, 0, 1003},
+    {"silicon_rev", 1, 0, 1004},
+    {"bl_version", 1, 0, 1005},
+    {"arrays", 1, 0, 1006},
+    {"first_row", 1, 0, 1007},
+    {"last_row", 1, 0, 1008},
+    {"row_size", 1, 0, 1009},
+    {"buffer_size", 1, 0, 1010},
+    {"write_latency", 1, 0, 1011},
+    {"baudrate", 1, 0, 1012},
+    {"crc", 0, 0, 1013},
+    {"multi_app", 0, 0, 1014},
+    {"key", 1, 0, 1015},
+    {"corrupt_row", 1, 0, 1016},
+    {"drop", 1, 0, 1017},
+    {"verbose", 0, 0, 1018},
+    {0,0,0,0}};
+  int ch;
+  while ((ch = getopt_long(argc, argv, "l:t:u:i:r:B:a:m:M:z:S:w:b:cAk:C:d:v", lo, NULL)) != -1) {
+    switch (ch) {
+    case 1000: case 'l':
+      a->link_given++;
+      if (optarg) a->link_arg = strdup(optarg);
+      a->link_orig = optarg;
+      break;
+    case 1001: case 't':
+      a->tcp_given++;
+      if (optarg) a->tcp_arg = atoi(optarg);
+      a->tcp_orig = optarg;
+      break;
+    case 1002: case 'u':
+      a->uhid_given++;
+      if (optarg) a->uhid_arg = strdup(optarg);
+      a->uhid_orig = optarg;
+      break;
+    case 1003: case 'i':
+      a->silicon_id_given++;
+      if (optarg) a->silicon_id_arg = strdup(optarg);
+      a->silicon_id_orig = optarg;
+      break;
+    case 1004: case 'r':
+      a->silicon_rev_given++;
+      if (optarg) a->silicon_rev_arg = strdup(optarg);
+      a->silicon_rev_orig = optarg;
+      break;
+    case 1005: case 'B':
+      a->bl_version_given++;
+      if (optarg) a->bl_version_arg = strdup(optarg);
+      a->bl_version_orig = optarg;
+      break;
+    case 1006: case 'a':
+      a->arrays_given++;
+      if (optarg) a->arrays_arg = atoi(optarg);
+      a->arrays_orig = optarg;
+      break;
+    case 1007: case 'm':
+      a->first_row_given++;
+      if (optarg) a->first_row_arg = atoi(optarg);
+      a->first_row_orig = optarg;
+      break;
+    case 1008: case 'M':
+      a->last_row_given++;
+      if (optarg) a->last_row_arg = atoi(optarg);
+      a->last_row_orig = optarg;
+      break;
+    case 1009: case 'z':
+      a->row_size_given++;
+      if (optarg) a->row_size_arg = atoi(optarg);
+      a->row_size_orig = optarg;
+      break;
+    case 1010: case 'S':
+      a->buffer_size_given++;
+      if (optarg) a->buffer_size_arg = atoi(optarg);
+      a->buffer_size_orig = optarg;
+      break;
+    case 1011: case 'w':
+      a->write_latency_given++;
+      if (optarg) a->write_latency_arg = atoi(optarg);
+      a->write_latency_orig = optarg;
+      break;
+    case 1012: case 'b':
+      a->baudrate_given++;
+      if (optarg) a->baudrate_arg = atoi(optarg);
+      a->baudrate_orig = optarg;
+      break;
+    case 1013: case 'c':
+      a->crc_given++;
+      a->crc_flag = !a->crc_flag;
+      break;
+    case 1014: case 'A':
+      a->multi_app_given++;
+      a->multi_app_flag = !a->multi_app_flag;
+      break;
+    case 1015: case 'k':
+      a->key_given++;
+      if (optarg) a->key_arg = strdup(optarg);
+      a->key_orig = optarg;
+      break;
+    case 1016: case 'C':
+      a->corrupt_row_given++;
+      a->corrupt_row_arg = realloc(a->corrupt_row_arg, a->corrupt_row_given * sizeof(*a->corrupt_row_arg));
+      a->corrupt_row_orig = realloc(a->corrupt_row_orig, a->corrupt_row_given * sizeof(char*));
+      a->corrupt_row_arg[a->corrupt_row_given-1] = atoi(optarg);
+      a->corrupt_row_orig[a->corrupt_row_given-1] = strdup(optarg);
+      break;
+    case 1017: case 'd':
+      a->drop_given++;
+      if (optarg) a->drop_arg = atoi(optarg);
+      a->drop_orig = optarg;
+      break;
+    case 1018: case 'v':
+      a->verbose_given++;
+      a->verbose_flag = !a->verbose_flag;
+      break;
+    default: return 1;
+    }
+  }
+  a->inputs = argv + optind; a->inputs_num = argc - optind;
+  return 0;
+}
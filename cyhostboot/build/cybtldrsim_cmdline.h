@@ -0,0 +1,66 @@
+#ifndef MINI_CYBTLDRSIM_CMDLINE_H
+#define MINI_CYBTLDRSIM_CMDLINE_H
+#ifndef CMDLINE_PARSER_PACKAGE
+#define CMDLINE_PARSER_PACKAGE "x"
+#endif
+struct cybtldrsim_args_info {
+  char * link_arg;
+  char * link_orig;
+  unsigned int link_given;
+  int tcp_arg;
+  char * tcp_orig;
+  unsigned int tcp_given;
+  char * uhid_arg;
+  char * uhid_orig;
+  unsigned int uhid_given;
+  char * silicon_id_arg;
+  char * silicon_id_orig;
+  unsigned int silicon_id_given;
+  char * silicon_rev_arg;
+  char * silicon_rev_orig;
+  unsigned int silicon_rev_given;
+  char * bl_version_arg;
+  char * bl_version_orig;
+  unsigned int bl_version_given;
+  int arrays_arg;
+  char * arrays_orig;
+  unsigned int arrays_given;
+  int first_row_arg;
+  char * first_row_orig;
+  unsigned int first_row_given;
+  int last_row_arg;
+  char * last_row_orig;
+  unsigned int last_row_given;
+  int row_size_arg;
+  char * row_size_orig;
+  unsigned int row_size_given;
+  int buffer_size_arg;
+  char * buffer_size_orig;
+  unsigned int buffer_size_given;
+  int write_latency_arg;
+  char * write_latency_orig;
+  unsigned int write_latency_given;
+  int baudrate_arg;
+  char * baudrate_orig;
+  unsigned int baudrate_given;
+  int crc_flag;
+  unsigned int crc_given;
+  int multi_app_flag;
+  unsigned int multi_app_given;
+  char * key_arg;
+  char * key_orig;
+  unsigned int key_given;
+  int *corrupt_row_arg;
+  char ** corrupt_row_orig;
+  unsigned int corrupt_row_min, corrupt_row_max;
+  unsigned int corrupt_row_given;
+  int drop_arg;
+  char * drop_orig;
+  unsigned int drop_given;
+  int verbose_flag;
+  unsigned int verbose_given;
+  char **inputs;
+  unsigned inputs_num;
+};
+int cybtldrsim_cmdline_parser(int argc, char **argv, struct cybtldrsim_args_info *args_info);
+#endif
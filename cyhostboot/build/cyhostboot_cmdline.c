@@ -0,0 +1,156 @@
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "cyhostboot_cmdline.h"
+int cyhostboot_cmdline_parser(int argc, char **argv, struct cyhostboot_args_info *a)
+{
+  memset(a, 0, sizeof(*a));
+  a->baudrate_arg = strdup("115200");
+  a->app_id_arg = 0;
+  a->transfer_size_arg = strdup("64");
+  a->timeout_arg = 1000;
+  a->low_latency_flag = 0;
+  a->io_uring_flag = 0;
+  a->retries_arg = 3;
+  a->retry_delay_arg = 20;
+  a->fast_flag = 0;
+  a->delta_flag = 0;
+  a->if_changed_flag = 0;
+  a->resume_flag = 0;
+  static struct option lo[] = {
+    {"baudrate", 1, 0, 1000},
+    {"file", 1, 0, 1001},
+    {"serial", 1, 0, 1002},
+    {"app_id", 1, 0, 1003},
+    {"transfer_size", 1, 0, 1004},
+    {"timeout", 1, 0, 1005},
+    {"low_latency", 0, 0, 1006},
+    {"io_uring", 0, 0, 1007},
+    {"retries", 1, 0, 1008},
+    {"retry_delay", 1, 0, 1009},
+    {"fast", 0, 0, 1010},
+    {"delta", 0, 0, 1011},
+    {"if_changed", 0, 0, 1012},
+    {"resume", 0, 0, 1013},
+    {"then", 1, 0, 1014},
+    {"trace", 1, 0, 1015},
+    {"key", 1, 0, 1016},
+    {"program", 0, 0, 1017},
+    {"erase", 0, 0, 1018},
+    {"verify", 0, 0, 1019},
+    {"noparity", 0, 0, 1020},
+    {"even", 0, 0, 1021},
+    {"odd", 0, 0, 1022},
+    {0,0,0,0}};
+  int ch;
+  while ((ch = getopt_long(argc, argv, "b:f:s:a:T:t:Lr:Fduk:pevNEO", lo, NULL)) != -1) {
+    switch (ch) {
+    case 1000: case 'b':
+      a->baudrate_given++;
+      if (optarg) a->baudrate_arg = strdup(optarg);
+      a->baudrate_orig = optarg;
+      break;
+    case 1001: case 'f':
+      a->file_given++;
+      if (optarg) a->file_arg = strdup(optarg);
+      a->file_orig = optarg;
+      break;
+    case 1002: case 's':
+      a->serial_given++;
+      a->serial_arg = realloc(a->serial_arg, a->serial_given * sizeof(*a->serial_arg));
+      a->serial_orig = realloc(a->serial_orig, a->serial_given * sizeof(char*));
+      a->serial_arg[a->serial_given-1] = strdup(optarg);
+      a->serial_orig[a->serial_given-1] = strdup(optarg);
+      break;
+    case 1003: case 'a':
+      a->app_id_given++;
+      if (optarg) a->app_id_arg = atoi(optarg);
+      a->app_id_orig = optarg;
+      break;
+    case 1004: case 'T':
+      a->transfer_size_given++;
+      if (optarg) a->transfer_size_arg = strdup(optarg);
+      a->transfer_size_orig = optarg;
+      break;
+    case 1005: case 't':
+      a->timeout_given++;
+      if (optarg) a->timeout_arg = atoi(optarg);
+      a->timeout_orig = optarg;
+      break;
+    case 1006: case 'L':
+      a->low_latency_given++;
+      a->low_latency_flag = !a->low_latency_flag;
+      break;
+    case 1007:
+      a->io_uring_given++;
+      a->io_uring_flag = !a->io_uring_flag;
+      break;
+    case 1008: case 'r':
+      a->retries_given++;
+      if (optarg) a->retries_arg = atoi(optarg);
+      a->retries_orig = optarg;
+      break;
+    case 1009:
+      a->retry_delay_given++;
+      if (optarg) a->retry_delay_arg = atoi(optarg);
+      a->retry_delay_orig = optarg;
+      break;
+    case 1010: case 'F':
+      a->fast_given++;
+      a->fast_flag = !a->fast_flag;
+      break;
+    case 1011: case 'd':
+      a->delta_given++;
+      a->delta_flag = !a->delta_flag;
+      break;
+    case 1012: case 'u':
+      a->if_changed_given++;
+      a->if_changed_flag = !a->if_changed_flag;
+      break;
+    case 1013:
+      a->resume_given++;
+      a->resume_flag = !a->resume_flag;
+      break;
+    case 1014:
+      a->then_given++;
+      a->then_arg = realloc(a->then_arg, a->then_given * sizeof(*a->then_arg));
+      a->then_orig = realloc(a->then_orig, a->then_given * sizeof(char*));
+      a->then_arg[a->then_given-1] = strdup(optarg);
+      a->then_orig[a->then_given-1] = strdup(optarg);
+      break;
+    case 1015:
+      a->trace_given++;
+      if (optarg) a->trace_arg = strdup(optarg);
+      a->trace_orig = optarg;
+      break;
+    case 1016: case 'k':
+      a->key_given++;
+      if (optarg) a->key_arg = strdup(optarg);
+      a->key_orig = optarg;
+      break;
+    case 1017: case 'p':
+      a->program_given++;
+      break;
+    case 1018: case 'e':
+      a->erase_given++;
+      break;
+    case 1019: case 'v':
+      a->verify_given++;
+      break;
+    case 1020: case 'N':
+      a->noparity_given++;
+      break;
+    case 1021: case 'E':
+      a->even_given++;
+      break;
+    case 1022: case 'O':
+      a->odd_given++;
+      break;
+    default: return 1;
+    }
+  }
+  if (!a->file_given) { fprintf(stderr, "missing --file\n"); return 1; }
+  a->inputs = argv + optind; a->inputs_num = argc - optind;
+  return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef MINI_CYHOSTBOOT_CMDLINE_H
+#define MINI_CYHOSTBOOT_CMDLINE_H
+#ifndef CMDLINE_PARSER_PACKAGE
+#define CMDLINE_PARSER_PACKAGE "x"
+#endif
+struct cyhostboot_args_info {
+  char * baudrate_arg;
+  char * baudrate_orig;
+  unsigned int baudrate_given;
+  char * file_arg;
+  char * file_orig;
+  unsigned int file_given;
+  char * *serial_arg;
+  char ** serial_orig;
+  unsigned int serial_min, serial_max;
+  unsigned int serial_given;
+  int app_id_arg;
+  char * app_id_orig;
+  unsigned int app_id_given;
+  char * transfer_size_arg;
+  char * transfer_size_orig;
+  unsigned int transfer_size_given;
+  int timeout_arg;
+  char * timeout_orig;
+  unsigned int timeout_given;
+  int low_latency_flag;
+  unsigned int low_latency_given;
+  int io_uring_flag;
+  unsigned int io_uring_given;
+  int retries_arg;
+  char * retries_orig;
+  unsigned int retries_given;
+  int retry_delay_arg;
+  char * retry_delay_orig;
+  unsigned int retry_delay_given;
+  int fast_flag;
+  unsigned int fast_given;
+  int delta_flag;
+  unsigned int delta_given;
+  int if_changed_flag;
+  unsigned int if_changed_given;
+  int resume_flag;
+  unsigned int resume_given;
+  char * *then_arg;
+  char ** then_orig;
+  unsigned int then_min, then_max;
+  unsigned int then_given;
+  char * trace_arg;
+  char * trace_orig;
+  unsigned int trace_given;
+  char * key_arg;
+  char * key_orig;
+  unsigned int key_given;
+  unsigned int program_given;
+  unsigned int erase_given;
+  unsigned int verify_given;
+  unsigned int noparity_given;
+  unsigned int even_given;
+  unsigned int odd_given;
+  char **inputs;
+  unsigned inputs_num;
+};
+int cyhostboot_cmdline_parser(int argc, char **argv, struct cyhostboot_args_info *args_info);
+#endif
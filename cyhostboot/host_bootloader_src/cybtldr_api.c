@@ -5,6 +5,11 @@
 * the software package with which this file was provided.
 ********************************************************************************/
 
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 #include "cybtldr_command.h"
 #include "cybtldr_api.h"
 
@@ -12,20 +17,72 @@
 #define MAX_DEV_ARRAYS    0x80
 /* The default value if a flash array has not yet received data */
 #define NO_FLASH_ARRAY_DATA 0
-/* The maximum number of flash arrays */
-#define MAX_FLASH_ARRAYS 0x40
 /* The minimum array id for EEPROM arrays. */
 #define MIN_EEPROM_ARRAY 0x40
 
-unsigned long g_validRows[MAX_FLASH_ARRAYS];
-static CyBtldr_CommunicationsData* g_comm;
+static void CyBtldr_Sleep(unsigned int milliseconds)
+{
+#ifdef WIN32
+    Sleep(milliseconds);
+#else
+    struct timespec ts;
+
+    ts.tv_sec = milliseconds / 1000;
+    ts.tv_nsec = (milliseconds % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/* Errors the packet may not hit when sent again: it or its response were lost
+ * or corrupted on the line */
+static int CyBtldr_IsLineError(int err)
+{
+    return (CYRET_ERR_COMM_MASK & err)
+        || ((CYRET_ERR_BTLDR_MASK | CYBTLDR_STAT_ERR_CHECKSUM) == err);
+}
 
-int CyBtldr_TransferData(unsigned char* inBuf, int inSize, unsigned char* outBuf, int outSize)
+/* Delay before the retry following the given attempt, doubled at each attempt
+ * up to a bound so that the shift stays defined and the wait reasonable */
+static unsigned int CyBtldr_RetryDelay(CyBtldr_Session* session, unsigned int attempt)
 {
-    int err = g_comm->WriteData(inBuf, inSize);
+    unsigned int delay = (session->retryDelay < CYBTLDR_MAX_RETRY_DELAY)
+        ? session->retryDelay
+        : CYBTLDR_MAX_RETRY_DELAY;
+
+    delay <<= (attempt < CYBTLDR_MAX_RETRY_SHIFT) ? attempt : CYBTLDR_MAX_RETRY_SHIFT;
+
+    return (delay < CYBTLDR_MAX_RETRY_DELAY) ? delay : CYBTLDR_MAX_RETRY_DELAY;
+}
+
+/* Decide whether to retry after the given attempt failed, and if so wait and
+ * send a sync command, which drops the data the bootloader buffered for a row */
+static int CyBtldr_Resync(CyBtldr_Session* session, unsigned int attempt)
+{
+    unsigned char inBuf[MAX_COMMAND_SIZE];
+    unsigned long inSize;
+    unsigned long outSize;
+
+    if (attempt >= session->retryCount || session->abort)
+        return 0;
+
+    /* Let late responses come in, the transport drops them before the next write */
+    if (NULL != session->comm->Delay)
+        session->comm->Delay(session->comm->Context, CyBtldr_RetryDelay(session, attempt));
+    else
+        CyBtldr_Sleep(CyBtldr_RetryDelay(session, attempt));
+    CyBtldr_CreateSyncBootLoaderCmd(session, inBuf, &inSize, &outSize);
+    session->comm->WriteData(session->comm->Context, inBuf, inSize);
+    session->retries++;
+
+    return 1;
+}
+
+static int CyBtldr_TransferPacket(CyBtldr_Session* session, unsigned char* inBuf, int inSize, unsigned char* outBuf, int outSize)
+{
+    int err = session->comm->WriteData(session->comm->Context, inBuf, inSize);
 
     if (CYRET_SUCCESS == err)
-        err = g_comm->ReadData(outBuf, outSize);
+        err = session->comm->ReadData(session->comm->Context, outBuf, outSize);
 
     if (CYRET_SUCCESS != err)
         err |= CYRET_ERR_COMM_MASK;
@@ -33,7 +90,30 @@ int CyBtldr_TransferData(unsigned char* inBuf, int inSize, unsigned char* outBuf
     return err;
 }
 
-int CyBtldr_ValidateRow(unsigned char arrayId, unsigned short rowNum)
+int CyBtldr_TransferData(CyBtldr_Session* session, unsigned char* inBuf, int inSize, unsigned char* outBuf, int outSize)
+{
+    /* A row sent in several packets can only be sent again as a whole, see
+     * CyBtldr_ProgramRow */
+    unsigned char canRetry = (CMD_SEND_DATA != inBuf[1]) && (CMD_PROGRAM_ROW != inBuf[1]);
+    unsigned int attempt;
+    int err;
+
+    for (attempt = 0; ; attempt++)
+    {
+        err = CyBtldr_TransferPacket(session, inBuf, inSize, outBuf, outSize);
+        /* The bootloader also reports packets corrupted on the line */
+        if (CYRET_SUCCESS == err && outSize > 1 && CYRET_SUCCESS != outBuf[1])
+            err = CYRET_ERR_BTLDR_MASK | outBuf[1];
+
+        if (!canRetry || !CyBtldr_IsLineError(err) || !CyBtldr_Resync(session, attempt))
+            break;
+    }
+
+    /* Bootloader errors are reported by the parsing of the response */
+    return (CYRET_ERR_BTLDR_MASK & err) ? CYRET_SUCCESS : err;
+}
+
+int CyBtldr_ValidateRow(CyBtldr_Session* session, unsigned char arrayId, unsigned short rowNum)
 {
     unsigned long inSize;
     unsigned long outSize;
@@ -46,11 +126,11 @@ int CyBtldr_ValidateRow(unsigned char arrayId, unsigned short rowNum)
 
     if (arrayId < MAX_FLASH_ARRAYS)
     {
-        if (NO_FLASH_ARRAY_DATA == g_validRows[arrayId])
+        if (NO_FLASH_ARRAY_DATA == session->validRows[arrayId])
         {
-            err = CyBtldr_CreateGetFlashSizeCmd(arrayId, inBuf, &inSize, &outSize);
+            err = CyBtldr_CreateGetFlashSizeCmd(session, arrayId, inBuf, &inSize, &outSize);
             if (CYRET_SUCCESS == err)
-                err = CyBtldr_TransferData(inBuf, inSize, outBuf, outSize);
+                err = CyBtldr_TransferData(session, inBuf, inSize, outBuf, outSize);
             if (CYRET_SUCCESS == err)
                 err = CyBtldr_ParseGetFlashSizeCmdResult(outBuf, outSize, &minRow, &maxRow, &status);
             if (CYRET_SUCCESS != status)
@@ -59,15 +139,15 @@ int CyBtldr_ValidateRow(unsigned char arrayId, unsigned short rowNum)
             if (CYRET_SUCCESS == err)
             {
                 if (CYRET_SUCCESS == status)
-                    g_validRows[arrayId] = (minRow << 16) + maxRow;
+                    session->validRows[arrayId] = (minRow << 16) + maxRow;
                 else
                     err = status | CYRET_ERR_BTLDR_MASK;
             }
         }
         if (CYRET_SUCCESS == err)
         {
-            minRow = (unsigned short)(g_validRows[arrayId] >> 16);
-            maxRow = (unsigned short)g_validRows[arrayId];
+            minRow = (unsigned short)(session->validRows[arrayId] >> 16);
+            maxRow = (unsigned short)session->validRows[arrayId];
             if (rowNum < minRow || rowNum > maxRow)
                 err = CYRET_ERR_ROW;
         }
@@ -79,7 +159,7 @@ int CyBtldr_ValidateRow(unsigned char arrayId, unsigned short rowNum)
 }
 
 
-int CyBtldr_StartBootloadOperation(CyBtldr_CommunicationsData* comm, unsigned long expSiId,
+int CyBtldr_StartBootloadOperation(CyBtldr_Session* session, unsigned long expSiId,
             unsigned char expSiRev, unsigned long* blVer, const unsigned char* securityKeyBuf)
 {
     const unsigned long SUPPORTED_BOOTLOADER = 0x010000;
@@ -94,26 +174,25 @@ int CyBtldr_StartBootloadOperation(CyBtldr_CommunicationsData* comm, unsigned lo
     unsigned char status = CYRET_SUCCESS;
     int err;
 
-    g_comm = comm;
     for (i = 0; i < MAX_FLASH_ARRAYS; i++)
-        g_validRows[i] = NO_FLASH_ARRAY_DATA;
+        session->validRows[i] = NO_FLASH_ARRAY_DATA;
 
-    err = g_comm->OpenConnection();
+    err = session->comm->OpenConnection(session->comm->Context);
     if (CYRET_SUCCESS != err)
         err |= CYRET_ERR_COMM_MASK;
 
     if (CYRET_SUCCESS == err) {
-        err = CyBtldr_CreateEnterBootLoaderCmd(inBuf, &inSize, &outSize, securityKeyBuf);
+        err = CyBtldr_CreateEnterBootLoaderCmd(session, inBuf, &inSize, &outSize, securityKeyBuf);
     }
     if (CYRET_SUCCESS == err) {
-        err = CyBtldr_TransferData(inBuf, inSize, outBuf, outSize);
+        err = CyBtldr_TransferData(session, inBuf, inSize, outBuf, outSize);
     }
     if (CYRET_SUCCESS == err) {
         err = CyBtldr_ParseEnterBootLoaderCmdResult(outBuf, outSize, &siliconId, &siliconRev, blVer, &status);
 	if (!err) {
 		printf("Got silicon id 0x%08lx, rev 0x%02x\n", siliconId, siliconRev);
 	}
-    } else if (CyBtldr_TryParseParketStatus(outBuf, outSize, &status) == CYRET_SUCCESS) {
+    } else if (CyBtldr_TryParseParketStatus(session, outBuf, outSize, &status) == CYRET_SUCCESS) {
         err = status | CYRET_ERR_BTLDR_MASK; //if the response we get back is a valid packet overide the err with the response's status
     }
     if (CYRET_SUCCESS == err)
@@ -129,7 +208,7 @@ int CyBtldr_StartBootloadOperation(CyBtldr_CommunicationsData* comm, unsigned lo
     return err;
 }
 
-int CyBtldr_GetApplicationStatus(unsigned char appID, unsigned char* isValid, unsigned char* isActive)
+int CyBtldr_GetApplicationStatus(CyBtldr_Session* session, unsigned char appID, unsigned char* isValid, unsigned char* isActive)
 {
     unsigned long inSize = 0;
     unsigned long outSize = 0;
@@ -138,9 +217,9 @@ int CyBtldr_GetApplicationStatus(unsigned char appID, unsigned char* isValid, un
     unsigned char status = CYRET_SUCCESS;
     int err;
 
-    err = CyBtldr_CreateGetAppStatusCmd(appID, inBuf, &inSize, &outSize);
+    err = CyBtldr_CreateGetAppStatusCmd(session, appID, inBuf, &inSize, &outSize);
     if (CYRET_SUCCESS == err)
-        err = CyBtldr_TransferData(inBuf, inSize, outBuf, outSize);
+        err = CyBtldr_TransferData(session, inBuf, inSize, outBuf, outSize);
     if (CYRET_SUCCESS == err)
         err = CyBtldr_ParseGetAppStatusCmdResult(outBuf, outSize, isValid, isActive, &status);
 
@@ -153,7 +232,7 @@ int CyBtldr_GetApplicationStatus(unsigned char appID, unsigned char* isValid, un
     return err;
 }
 
-int CyBtldr_SetApplicationStatus(unsigned char appID)
+int CyBtldr_SetApplicationStatus(CyBtldr_Session* session, unsigned char appID)
 {
     unsigned long inSize = 0;
     unsigned long outSize = 0;
@@ -162,9 +241,9 @@ int CyBtldr_SetApplicationStatus(unsigned char appID)
     unsigned char status = CYRET_SUCCESS;
     int err;
 
-    err = CyBtldr_CreateSetActiveAppCmd(appID, inBuf, &inSize, &outSize);
+    err = CyBtldr_CreateSetActiveAppCmd(session, appID, inBuf, &inSize, &outSize);
     if (CYRET_SUCCESS == err)
-        err = CyBtldr_TransferData(inBuf, inSize, outBuf, outSize);
+        err = CyBtldr_TransferData(session, inBuf, inSize, outBuf, outSize);
     if (CYRET_SUCCESS == err)
         err = CyBtldr_ParseSetActiveAppCmdResult(outBuf, outSize, &status);
 
@@ -177,29 +256,94 @@ int CyBtldr_SetApplicationStatus(unsigned char appID)
     return err;
 }
 
-int CyBtldr_EndBootloadOperation(void)
+int CyBtldr_EndBootloadOperation(CyBtldr_Session* session)
 {
     unsigned long inSize;
     unsigned long outSize;
     unsigned char inBuf[MAX_COMMAND_SIZE];
 
-    int err = CyBtldr_CreateExitBootLoaderCmd(inBuf, &inSize, &outSize);
+    int err = CyBtldr_CreateExitBootLoaderCmd(session, inBuf, &inSize, &outSize);
     if (CYRET_SUCCESS == err)
     {
-        err = g_comm->WriteData(inBuf, inSize);
+        err = session->comm->WriteData(session->comm->Context, inBuf, inSize);
 
         if (CYRET_SUCCESS == err)
-            err = g_comm->CloseConnection();
+            err = session->comm->CloseConnection(session->comm->Context);
 
         if (CYRET_SUCCESS != err)
             err |= CYRET_ERR_COMM_MASK;
     }
-    g_comm = NULL;
 
     return err;
 }
 
-int CyBtldr_ProgramRow(unsigned char arrayID, unsigned short rowNum, unsigned char* buf, unsigned short size)
+static int CyBtldr_ProbeTransferSizeOnce(CyBtldr_Session* session, unsigned int transferSize)
+{
+    const unsigned int TRANSFER_HEADER_SIZE = 11;
+
+    unsigned char data[MAX_COMMAND_SIZE] = { 0 };
+    unsigned char inBuf[MAX_COMMAND_SIZE];
+    unsigned char outBuf[MAX_COMMAND_SIZE];
+    unsigned long inSize;
+    unsigned long outSize;
+    unsigned char status = CYRET_SUCCESS;
+    int err;
+
+    /* Send as much data as CyBtldr_ProgramRow puts in each packet of this size */
+    err = CyBtldr_CreateSendDataCmd(session, data, (unsigned short)(transferSize - TRANSFER_HEADER_SIZE), inBuf, &inSize, &outSize);
+    if (CYRET_SUCCESS == err)
+        err = CyBtldr_TransferData(session, inBuf, inSize, outBuf, outSize);
+    if (CYRET_SUCCESS == err)
+        err = CyBtldr_ParseSendDataCmdResult(outBuf, outSize, &status);
+    if (CYRET_SUCCESS != status)
+        err = status | CYRET_ERR_BTLDR_MASK;
+
+    return err;
+}
+
+int CyBtldr_ProbeTransferSize(CyBtldr_Session* session)
+{
+    const unsigned int TRANSFER_HEADER_SIZE = 11;
+    const unsigned int DEFAULT_TRANSFER_SIZE = 64;
+    /* Biggest packet first, then packets holding a whole 256 or 128 byte row */
+    const unsigned int transferSizes[] = { MAX_COMMAND_SIZE, 256 + TRANSFER_HEADER_SIZE, 128 + TRANSFER_HEADER_SIZE };
+
+    unsigned char inBuf[MAX_COMMAND_SIZE];
+    unsigned long inSize;
+    unsigned long outSize;
+    unsigned int attempt;
+    unsigned int i;
+    int err = CYRET_ERR_LENGTH;
+
+    for (i = 0; (CYRET_SUCCESS != err) && (i < sizeof(transferSizes) / sizeof(transferSizes[0])); i++)
+    {
+        /* A lost response must not be taken for a rejected size */
+        for (attempt = 0; ; attempt++)
+        {
+            err = CyBtldr_ProbeTransferSizeOnce(session, transferSizes[i]);
+            if (!CyBtldr_IsLineError(err) || !CyBtldr_Resync(session, attempt))
+                break;
+        }
+
+        /* The bootloader does not answer sync, which drops the probe data */
+        CyBtldr_CreateSyncBootLoaderCmd(session, inBuf, &inSize, &outSize);
+        if (CYRET_SUCCESS != session->comm->WriteData(session->comm->Context, inBuf, inSize))
+            return CYRET_ERR_COMM_MASK;
+
+        if (CYRET_SUCCESS == err)
+            session->comm->MaxTransferSize = transferSizes[i];
+    }
+
+    if (CYRET_SUCCESS != err)
+    {
+        session->comm->MaxTransferSize = DEFAULT_TRANSFER_SIZE;
+        err = CYRET_ERR_LENGTH;
+    }
+
+    return err;
+}
+
+static int CyBtldr_ProgramRowOnce(CyBtldr_Session* session, unsigned char arrayID, unsigned short rowNum, unsigned char* buf, unsigned short size)
 {
     const int TRANSFER_HEADER_SIZE = 11;
 
@@ -211,18 +355,15 @@ int CyBtldr_ProgramRow(unsigned char arrayID, unsigned short rowNum, unsigned ch
     unsigned short subBufSize;
     unsigned char status = CYRET_SUCCESS;
     int err = CYRET_SUCCESS;
-    
-    if (arrayID < MAX_FLASH_ARRAYS)
-        err = CyBtldr_ValidateRow(arrayID, rowNum);
 
     //Break row into pieces to ensure we don't send too much for the transfer protocol
-    while ((CYRET_SUCCESS == err) && ((size - offset + TRANSFER_HEADER_SIZE) > g_comm->MaxTransferSize))
+    while ((CYRET_SUCCESS == err) && ((size - offset + TRANSFER_HEADER_SIZE) > session->comm->MaxTransferSize))
     {
-        subBufSize = (unsigned short)(g_comm->MaxTransferSize - TRANSFER_HEADER_SIZE);
+        subBufSize = (unsigned short)(session->comm->MaxTransferSize - TRANSFER_HEADER_SIZE);
 
-        err = CyBtldr_CreateSendDataCmd(&buf[offset], subBufSize, inBuf, &inSize, &outSize);
+        err = CyBtldr_CreateSendDataCmd(session, &buf[offset], subBufSize, inBuf, &inSize, &outSize);
         if (CYRET_SUCCESS == err)
-            err = CyBtldr_TransferData(inBuf, inSize, outBuf, outSize);
+            err = CyBtldr_TransferData(session, inBuf, inSize, outBuf, outSize);
         if (CYRET_SUCCESS == err)
             err = CyBtldr_ParseSendDataCmdResult(outBuf, outSize, &status);
         if (CYRET_SUCCESS != status)
@@ -235,9 +376,9 @@ int CyBtldr_ProgramRow(unsigned char arrayID, unsigned short rowNum, unsigned ch
     {
         subBufSize = (unsigned short)(size - offset);
 
-        err = CyBtldr_CreateProgramRowCmd(arrayID, rowNum, &buf[offset], subBufSize, inBuf, &inSize, &outSize);
+        err = CyBtldr_CreateProgramRowCmd(session, arrayID, rowNum, &buf[offset], subBufSize, inBuf, &inSize, &outSize);
         if (CYRET_SUCCESS == err)
-            err = CyBtldr_TransferData(inBuf, inSize, outBuf, outSize);
+            err = CyBtldr_TransferData(session, inBuf, inSize, outBuf, outSize);
         if (CYRET_SUCCESS == err)
             err = CyBtldr_ParseProgramRowCmdResult(outBuf, outSize, &status);
         if (CYRET_SUCCESS != status)
@@ -247,7 +388,30 @@ int CyBtldr_ProgramRow(unsigned char arrayID, unsigned short rowNum, unsigned ch
     return err;
 }
 
-int CyBtldr_EraseRow(unsigned char arrayID, unsigned short rowNum)
+int CyBtldr_ProgramRow(CyBtldr_Session* session, unsigned char arrayID, unsigned short rowNum, unsigned char* buf, unsigned short size)
+{
+    unsigned int attempt;
+    int err = CYRET_SUCCESS;
+
+    /* Validated once, its own packet is already retried by CyBtldr_TransferData */
+    if (arrayID < MAX_FLASH_ARRAYS)
+        err = CyBtldr_ValidateRow(session, arrayID, rowNum);
+
+    /* The sync drops the part of the row already sent, send it all again */
+    if (CYRET_SUCCESS == err)
+    {
+        for (attempt = 0; ; attempt++)
+        {
+            err = CyBtldr_ProgramRowOnce(session, arrayID, rowNum, buf, size);
+            if (!CyBtldr_IsLineError(err) || !CyBtldr_Resync(session, attempt))
+                break;
+        }
+    }
+
+    return err;
+}
+
+int CyBtldr_EraseRow(CyBtldr_Session* session, unsigned char arrayID, unsigned short rowNum)
 {
     unsigned char inBuf[MAX_COMMAND_SIZE];
     unsigned char outBuf[MAX_COMMAND_SIZE];
@@ -257,11 +421,11 @@ int CyBtldr_EraseRow(unsigned char arrayID, unsigned short rowNum)
     int err = CYRET_SUCCESS;
     
     if (arrayID < MAX_FLASH_ARRAYS)
-        err = CyBtldr_ValidateRow(arrayID, rowNum);
+        err = CyBtldr_ValidateRow(session, arrayID, rowNum);
     if (CYRET_SUCCESS == err)
-        err = CyBtldr_CreateEraseRowCmd(arrayID, rowNum, inBuf, &inSize, &outSize);
+        err = CyBtldr_CreateEraseRowCmd(session, arrayID, rowNum, inBuf, &inSize, &outSize);
     if (CYRET_SUCCESS == err)
-        err = CyBtldr_TransferData(inBuf, inSize, outBuf, outSize);
+        err = CyBtldr_TransferData(session, inBuf, inSize, outBuf, outSize);
     if (CYRET_SUCCESS == err)
         err = CyBtldr_ParseEraseRowCmdResult(outBuf, outSize, &status);
     if (CYRET_SUCCESS != status)
@@ -270,7 +434,7 @@ int CyBtldr_EraseRow(unsigned char arrayID, unsigned short rowNum)
     return err;
 }
 
-int CyBtldr_VerifyRow(unsigned char arrayID, unsigned short rowNum, unsigned char checksum)
+int CyBtldr_VerifyRow(CyBtldr_Session* session, unsigned char arrayID, unsigned short rowNum, unsigned char checksum)
 {
     unsigned char inBuf[MAX_COMMAND_SIZE];
     unsigned char outBuf[MAX_COMMAND_SIZE];
@@ -281,11 +445,11 @@ int CyBtldr_VerifyRow(unsigned char arrayID, unsigned short rowNum, unsigned cha
     int err = CYRET_SUCCESS;
     
     if (arrayID < MAX_FLASH_ARRAYS)
-        err = CyBtldr_ValidateRow(arrayID, rowNum);
+        err = CyBtldr_ValidateRow(session, arrayID, rowNum);
     if (CYRET_SUCCESS == err)
-        err = CyBtldr_CreateVerifyRowCmd(arrayID, rowNum, inBuf, &inSize, &outSize);
+        err = CyBtldr_CreateVerifyRowCmd(session, arrayID, rowNum, inBuf, &inSize, &outSize);
     if (CYRET_SUCCESS == err)
-        err = CyBtldr_TransferData(inBuf, inSize, outBuf, outSize);
+        err = CyBtldr_TransferData(session, inBuf, inSize, outBuf, outSize);
     if (CYRET_SUCCESS == err)
         err = CyBtldr_ParseVerifyRowCmdResult(outBuf, outSize, &rowChecksum, &status);
     if (CYRET_SUCCESS != status)
@@ -296,7 +460,7 @@ int CyBtldr_VerifyRow(unsigned char arrayID, unsigned short rowNum, unsigned cha
     return err;
 }
 
-int CyBtldr_VerifyApplication()
+int CyBtldr_VerifyApplication(CyBtldr_Session* session)
 {
     unsigned char inBuf[MAX_COMMAND_SIZE];
     unsigned char outBuf[MAX_COMMAND_SIZE];
@@ -305,9 +469,9 @@ int CyBtldr_VerifyApplication()
     unsigned char checksumValid = 0;
     unsigned char status = CYRET_SUCCESS;
 
-    int err = CyBtldr_CreateVerifyChecksumCmd(inBuf, &inSize, &outSize);
+    int err = CyBtldr_CreateVerifyChecksumCmd(session, inBuf, &inSize, &outSize);
     if (CYRET_SUCCESS == err)
-        err = CyBtldr_TransferData(inBuf, inSize, outBuf, outSize);
+        err = CyBtldr_TransferData(session, inBuf, inSize, outBuf, outSize);
     if (CYRET_SUCCESS == err)
         err = CyBtldr_ParseVerifyChecksumCmdResult(outBuf, outSize, &checksumValid, &status);
     if (CYRET_SUCCESS != status)
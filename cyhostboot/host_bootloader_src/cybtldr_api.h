@@ -8,38 +8,20 @@
 #ifndef __CYBTLDR_API_H__
 #define __CYBTLDR_API_H__
 
-#include "cybtldr_utils.h"
-
-/*
- * This struct defines all of the items necessary for the bootloader
- * host to communicate over an arbitrary communication protocol. The
- * caller must provide implementations of these items to use their
- * deisred communication protocol.
- */
-typedef struct
-{
-    /* Function used to open the communications connection */
-    int (*OpenConnection)(void);
-    /* Function used to close the communications connection */
-    int (*CloseConnection)(void);
-    /* Function used to read data over the communications connection */
-    int (*ReadData)(unsigned char*, int);
-    /* Function used to write data over the communications connection */
-    int (*WriteData)(unsigned char*, int);
-    /* Value used to specify the maximum number of bytes that can be trasfered at a time */
-    unsigned int MaxTransferSize;
-} CyBtldr_CommunicationsData;
-
-
+#include "cybtldr_session.h"
 
 /*******************************************************************************
 * Function Name: CyBtldr_TransferData
 ********************************************************************************
 * Summary:
 *   This function is responsible for transfering a buffer of data to the target
-*   device and then reading a response packet back from the device.
+*   device and then reading a response packet back from the device.  If the
+*   packet or its response is lost or corrupted on the line, it is sent again
+*   up to session->retryCount times after a sync command, except for the
+*   packets of a row (see CyBtldr_ProgramRow).
 *
 * Parameters:
+*   session - The session to communicate with
 *   inBuf   - The buffer containing data to send to the target device
 *   inSize  - The number of bytes to send to the target device
 *   outBuf  - The buffer to store the data read from the device
@@ -50,7 +32,7 @@ typedef struct
 *   CYRET_ERR_COMM - There was a communication error talking to the device
 *
 *******************************************************************************/
-int CyBtldr_TransferData(unsigned char* inBuf, int inSize, unsigned char* outBuf, int outSize);
+int CyBtldr_TransferData(CyBtldr_Session* session, unsigned char* inBuf, int inSize, unsigned char* outBuf, int outSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ValidateRow
@@ -60,6 +42,7 @@ int CyBtldr_TransferData(unsigned char* inBuf, int inSize, unsigned char* outBuf
 *   row number are valid for a bootload operation.
 *
 * Parameters:
+*   session - The session to communicate with
 *   arrayId - The array to check
 *   rowNum  - The row number within the array to check
 *
@@ -69,7 +52,7 @@ int CyBtldr_TransferData(unsigned char* inBuf, int inSize, unsigned char* outBuf
 *   CYRET_ERR_ROW   - The array/row number is not valid for communication
 *
 *******************************************************************************/
-int CyBtldr_ValidateRow(unsigned char arrayId, unsigned short rowNum);
+int CyBtldr_ValidateRow(CyBtldr_Session* session, unsigned char arrayId, unsigned short rowNum);
 
 /*******************************************************************************
 * Function Name: CyBtldr_StartBootloadOperation
@@ -81,7 +64,7 @@ int CyBtldr_ValidateRow(unsigned char arrayId, unsigned short rowNum);
 *   complete.
 *
 * Parameters:
-*   comm               Communication struct used for communicating with the target device
+*   session           - The session to start, holding the communication struct
 *   expSiId           - The Silicon ID of the device we expect to communicate with
 *   expSiRev          - The Silicon Rev of the device we expect to communicate with
 *   blVer             - The Bootloader version that is running on the device
@@ -95,7 +78,7 @@ int CyBtldr_ValidateRow(unsigned char arrayId, unsigned short rowNum);
 *   CYRET_ERR_COMM    - There was a communication error talking to the device
 *
 *******************************************************************************/
-EXTERN int CyBtldr_StartBootloadOperation(CyBtldr_CommunicationsData* comm, unsigned long expSiId,
+EXTERN int CyBtldr_StartBootloadOperation(CyBtldr_Session* session, unsigned long expSiId,
             unsigned char expSiRev, unsigned long* blVer, const unsigned char* securityKeyBuf);
 
 /*******************************************************************************
@@ -106,7 +89,7 @@ EXTERN int CyBtldr_StartBootloadOperation(CyBtldr_CommunicationsData* comm, unsi
 *   bootload commands have been sent and no more communication is desired.
 *
 * Parameters:
-*   void.
+*   session - The session to communicate with
 *
 * Returns:
 *   CYRET_SUCCESS   - The end request was sent successfully
@@ -114,7 +97,7 @@ EXTERN int CyBtldr_StartBootloadOperation(CyBtldr_CommunicationsData* comm, unsi
 *   CYRET_ERR_COMM  - There was a communication error talking to the device
 *
 *******************************************************************************/
-EXTERN int CyBtldr_EndBootloadOperation(void);
+EXTERN int CyBtldr_EndBootloadOperation(CyBtldr_Session* session);
 
 /*******************************************************************************
 * Function Name: CyBtldr_GetApplicationStatus
@@ -127,6 +110,7 @@ EXTERN int CyBtldr_EndBootloadOperation(void);
 *   NOTE: This is only valid for multi application bootloaders.
 *
 * Parameters:
+*   session  - The session to communicate with
 *   appID    - The application ID to get status information for
 *   isValid  - Is the provided application valid to be executed
 *   isActive - Is the provided application already marked as the active app
@@ -139,7 +123,7 @@ EXTERN int CyBtldr_EndBootloadOperation(void);
 *   CYRET_ERR_DATA  - The result packet does not contain valid data
 *
 *******************************************************************************/
-EXTERN int CyBtldr_GetApplicationStatus(unsigned char appID, unsigned char* isValid, unsigned char* isActive);
+EXTERN int CyBtldr_GetApplicationStatus(CyBtldr_Session* session, unsigned char appID, unsigned char* isValid, unsigned char* isActive);
 
 /*******************************************************************************
 * Function Name: CyBtldr_SetApplicationStatus
@@ -150,6 +134,7 @@ EXTERN int CyBtldr_GetApplicationStatus(unsigned char appID, unsigned char* isVa
 *   NOTE: This is only valid for multi application bootloaders.
 *
 * Parameters:
+*   session  - The session to communicate with
 *   appID    - The application ID to set as the active application 
 *
 * Returns:
@@ -161,15 +146,41 @@ EXTERN int CyBtldr_GetApplicationStatus(unsigned char appID, unsigned char* isVa
 *   CYRET_ERR_APP   - The application is not valid and cannot be set as active
 *
 *******************************************************************************/
-EXTERN int CyBtldr_SetApplicationStatus(unsigned char appID);
+EXTERN int CyBtldr_SetApplicationStatus(CyBtldr_Session* session, unsigned char appID);
+
+/*******************************************************************************
+* Function Name: CyBtldr_ProbeTransferSize
+********************************************************************************
+* Summary:
+*   Finds the biggest packet accepted by the bootloader by sending it send data
+*   commands of decreasing size, and stores it in the MaxTransferSize of the
+*   session communication struct.  A packet failing on the line is sent again
+*   like any other one, so a rejected packet may cost a full response timeout
+*   per retry.  Falls back to 64 byte packets if none of the sizes is accepted.
+*   Must be called after the bootload operation was started.
+*
+* Parameters:
+*   session - The session to communicate with
+*
+* Returns:
+*   CYRET_SUCCESS    - The transfer size was set to one of the probed sizes
+*   CYRET_ERR_LENGTH - None of the sizes was accepted, the transfer size was
+*                      set to 64 bytes, which the session can still use
+*   CYRET_ERR_COMM   - There was a communication error talking to the device
+*
+*******************************************************************************/
+EXTERN int CyBtldr_ProbeTransferSize(CyBtldr_Session* session);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ProgramRow
 ********************************************************************************
 * Summary:
-*   Sends a single row of data to the bootloader to be programmed into flash
+*   Sends a single row of data to the bootloader to be programmed into flash.
+*   If a packet of the row is lost or corrupted on the line, the whole row is
+*   sent again up to session->retryCount times after a sync command.
 *
 * Parameters:
+*   session - The session to communicate with
 *   arrayID  The flash array that is to be reprogrammed
 *   rowNum   The row number within the array that is to be reprogrammed
 *   buf      The buffer of data to program into the devices flash
@@ -185,7 +196,7 @@ EXTERN int CyBtldr_SetApplicationStatus(unsigned char appID);
 *   CYRET_ERR_ACTIVE - The application is currently marked as active
 *
 *******************************************************************************/
-EXTERN int CyBtldr_ProgramRow(unsigned char arrayID, unsigned short rowNum, unsigned char* buf, unsigned short size);
+EXTERN int CyBtldr_ProgramRow(CyBtldr_Session* session, unsigned char arrayID, unsigned short rowNum, unsigned char* buf, unsigned short size);
 
 /*******************************************************************************
 * Function Name: CyBtldr_EraseRow
@@ -194,6 +205,7 @@ EXTERN int CyBtldr_ProgramRow(unsigned char arrayID, unsigned short rowNum, unsi
 *   Erases a single row of flash data from the device.
 *
 * Parameters:
+*   session - The session to communicate with
 *   arrayID  The flash array that is to have a row erased
 *   rowNum   The row number within the array that is to be erased
 *
@@ -208,7 +220,7 @@ EXTERN int CyBtldr_ProgramRow(unsigned char arrayID, unsigned short rowNum, unsi
 *   CYRET_ERR_ACTIVE - The application is currently marked as active
 *
 *******************************************************************************/
-EXTERN int CyBtldr_EraseRow(unsigned char arrayID, unsigned short rowNum);
+EXTERN int CyBtldr_EraseRow(CyBtldr_Session* session, unsigned char arrayID, unsigned short rowNum);
 
 /*******************************************************************************
 * Function Name: CyBtldr_VerifyRow
@@ -218,6 +230,7 @@ EXTERN int CyBtldr_EraseRow(unsigned char arrayID, unsigned short rowNum);
 *   matches the expected value.
 *
 * Parameters:
+*   session  - The session to communicate with
 *   arrayID   The flash array that is to be verified
 *   rowNum    The row number within the array that is to be verified
 *   checksum  The expected checksum value for the row
@@ -233,7 +246,7 @@ EXTERN int CyBtldr_EraseRow(unsigned char arrayID, unsigned short rowNum);
 *   CYRET_ERR_COMM     - There was a communication error talking to the device
 *
 *******************************************************************************/
-EXTERN int CyBtldr_VerifyRow(unsigned char arrayID, unsigned short rowNum, unsigned char checksum);
+EXTERN int CyBtldr_VerifyRow(CyBtldr_Session* session, unsigned char arrayID, unsigned short rowNum, unsigned char checksum);
 
 /*******************************************************************************
 * Function Name: CyBtldr_VerifyApplication
@@ -244,7 +257,7 @@ EXTERN int CyBtldr_VerifyRow(unsigned char arrayID, unsigned short rowNum, unsig
 *   image is valid and ready to execute.
 *
 * Parameters:
-*   void
+*   session - The session to communicate with
 *
 * Returns:
 *   CYRET_SUCCESS      - The application was verified successfully
@@ -255,6 +268,6 @@ EXTERN int CyBtldr_VerifyRow(unsigned char arrayID, unsigned short rowNum, unsig
 *   CYRET_ERR_COMM     - There was a communication error talking to the device
 *
 *******************************************************************************/
-EXTERN int CyBtldr_VerifyApplication();
+EXTERN int CyBtldr_VerifyApplication(CyBtldr_Session* session);
 
 #endif
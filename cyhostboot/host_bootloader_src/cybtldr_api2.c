@@ -11,169 +11,379 @@
 #include "cybtldr_api.h"
 #include "cybtldr_api2.h"
 
-unsigned char g_abort;
+static unsigned char CyBtldr_RowChecksum(unsigned char checksum, unsigned char arrayId, unsigned short rowNum,
+    unsigned short bufSize)
+{
+    return (unsigned char)(checksum + arrayId + rowNum + (rowNum >> 8) + bufSize + (bufSize >> 8));
+}
+
+/* Check if the device already holds the image: the application checksum
+ * must be valid and a sample of rows must match, always including the last
+ * one which holds the application metadata and its checksum. Returns
+ * CYRET_SUCCESS if the device is up to date. */
+static int CyBtldr_CheckUpToDate(CyBtldr_Session* session, const CyBtldr_Image* image)
+{
+    const unsigned int SAMPLE_COUNT = 8;
+
+    const CyBtldr_Row* row;
+    unsigned int step;
+    unsigned int i;
+    int err;
+
+    err = CyBtldr_VerifyApplication(session);
+
+    step = (image->rowCount > SAMPLE_COUNT) ? image->rowCount / SAMPLE_COUNT : 1;
+    for (i = 0; CYRET_SUCCESS == err && i < image->rowCount; i++)
+    {
+        if (0 == i % step || i == image->rowCount - 1)
+        {
+            row = &image->rows[i];
+            err = CyBtldr_VerifyRow(session, row->arrayId, row->rowNum,
+                CyBtldr_RowChecksum(row->checksum, row->arrayId, row->rowNum, row->size));
+        }
+    }
 
-int CyBtldr_RunAction(CyBtldr_Action action, const char* file, const unsigned char* securityKey, 
-    unsigned char appId, CyBtldr_CommunicationsData* comm, CyBtldr_ProgressUpdate* update)
+    return err;
+}
+
+/* Verify each row of the image again to find the one that made the
+ * application checksum fail */
+static int CyBtldr_LocateBadRow(CyBtldr_Session* session, const CyBtldr_Image* image)
+{
+    const CyBtldr_Row* row;
+    unsigned int i;
+    int err = CYRET_SUCCESS;
+
+    for (i = 0; CYRET_SUCCESS == err && i < image->rowCount; i++)
+    {
+        row = &image->rows[i];
+        err = CyBtldr_VerifyRow(session, row->arrayId, row->rowNum,
+            CyBtldr_RowChecksum(row->checksum, row->arrayId, row->rowNum, row->size));
+        if (CYRET_SUCCESS != err)
+        {
+            session->errRowValid = 1;
+            session->errRowIdx = i;
+            session->errArrayId = row->arrayId;
+            session->errRowNum = row->rowNum;
+        }
+    }
+
+    /* All rows match, only the application checksum is wrong */
+    return (CYRET_SUCCESS == err)
+        ? CYRET_ERR_CHECKSUM
+        : err;
+}
+
+/* Find the row to resume programming from: the last rows before the resume
+ * point must still be on the device.  Programming continues from the first one
+ * that is not, or from the start of the image if none of them is. */
+static int CyBtldr_FindResumeRow(CyBtldr_Session* session, const CyBtldr_Image* image, unsigned int* startRow)
+{
+    const unsigned int CHECK_COUNT = 4;
+
+    const CyBtldr_Row* row;
+    unsigned int resumeRow;
+    unsigned int firstRow;
+    int err = CYRET_SUCCESS;
+
+    resumeRow = (session->resumeRow < image->rowCount) ? session->resumeRow : image->rowCount;
+    firstRow = (resumeRow > CHECK_COUNT) ? resumeRow - CHECK_COUNT : 0;
+    for (*startRow = firstRow; (CYRET_SUCCESS == err) && (*startRow < resumeRow); (*startRow)++)
+    {
+        row = &image->rows[*startRow];
+        err = CyBtldr_VerifyRow(session, row->arrayId, row->rowNum,
+            CyBtldr_RowChecksum(row->checksum, row->arrayId, row->rowNum, row->size));
+    }
+
+    if (CYRET_ERR_CHECKSUM == err)
+    {
+        (*startRow)--;
+        err = CYRET_SUCCESS;
+        /* The device does not hold what the resume point says */
+        if (*startRow == firstRow)
+            *startRow = 0;
+    }
+    return err;
+}
+
+int CyBtldr_RunAction(CyBtldr_Session* session, CyBtldr_Action action, const char* file, const unsigned char* securityKey, 
+    unsigned char appId, CyBtldr_ProgressUpdate* update)
+{
+    CyBtldr_Image image;
+
+    int err = CyBtldr_LoadImage(file, &image);
+    if (CYRET_SUCCESS == err)
+    {
+        err = CyBtldr_RunActionImage(session, action, &image, securityKey, appId, update);
+        CyBtldr_FreeImage(&image);
+    }
+
+    return err;
+}
+
+int CyBtldr_RunActionImage(CyBtldr_Session* session, CyBtldr_Action action, const CyBtldr_Image* image, const unsigned char* securityKey, 
+    unsigned char appId, CyBtldr_ProgressUpdate* update)
+{
+    CyBtldr_Step step;
+
+    step.action = action;
+    step.image = image;
+    step.appId = appId;
+
+    return CyBtldr_RunSteps(session, &step, 1, securityKey, update);
+}
+
+/* Run one step once the bootloader is entered, rowsRun is set once the rows
+ * of the image are being processed */
+static int CyBtldr_RunStep(CyBtldr_Session* session, const CyBtldr_Step* step, unsigned long blVer,
+    unsigned char resume, CyBtldr_ProgressUpdate* update, unsigned char* rowsRun)
 {
     const unsigned long BL_VER_SUPPORT_VERIFY = 0x010214; /* Support for full flash verify added in v2.20 of cy_boot */
     const unsigned char INVALID_APP = 0xFF;
 
-    unsigned long blVer = 0;
-    unsigned long siliconId = 0;
-    unsigned short rowNum = 0;
-    unsigned short bufSize = 0;
-    unsigned char siliconRev = 0;
-    unsigned char chksumtype = SUM_CHECKSUM;
-    unsigned char checksum = 0;
+    CyBtldr_Action action = step->action;
+    const CyBtldr_Image* image = step->image;
+    unsigned char appId = step->appId;
     unsigned char checksum2 = 0;
-    unsigned char arrayId = 0;
     unsigned char isValid;
     unsigned char isActive;
-    unsigned char buffer[MAX_BUFFER_SIZE];
-    char line[MAX_BUFFER_SIZE];
-    unsigned int lineLen;
-    int err;
-    unsigned char bootloaderEntered = 0;
-	
-    g_abort = 0;
+    const CyBtldr_Row* row;
+    unsigned int rowIdx;
+    unsigned int startRow = 0;
+    int err = CYRET_SUCCESS;
+    /* Rows are only checked once the whole application is written */
+    unsigned char fastProgram = (PROGRAM == action) && (session->flags & CYBTLDR_FLAG_FAST_PROGRAM)
+        && (blVer >= BL_VER_SUPPORT_VERIFY);
+    unsigned char deltaProgram = (PROGRAM == action) && (session->flags & CYBTLDR_FLAG_DELTA_PROGRAM);
+    unsigned char singleApp = 0;
 
-    err = CyBtldr_OpenDataFile(file);
-    if (CYRET_SUCCESS == err)
+    session->errRowValid = 0;
+    session->skippedRows = 0;
+    session->upToDate = 0;
+
+    appId -= 1; /* 1 and 2 are legal inputs to function. 0 and 1 are valid for bootloader component */
+    if (appId > 1)
     {
-        err = CyBtldr_ReadLine(&lineLen, line);
-        if (CYRET_SUCCESS == err)
-            err = CyBtldr_ParseHeader(lineLen, line, &siliconId, &siliconRev, &chksumtype);
+        appId = INVALID_APP;
+        singleApp = 1;
+    }
+
+    if (appId != INVALID_APP)
+    {
+		/* This will return error if bootloader is for single app */
+        err = CyBtldr_GetApplicationStatus(session, appId, &isValid, &isActive);
 
+        /* Active app can be verified, but not programmed or erased */
+        if (CYRET_SUCCESS == err && VERIFY != action && isActive)
+		{
+			/* This is multi app */
+			err = CYRET_ERR_ACTIVE;
+		}
+		else if (CYBTLDR_STAT_ERR_CMD == (err ^ (int)CYRET_ERR_BTLDR_MASK))
+		{
+			/* Single app - restore previous CYRET_SUCCESS */
+			err = CYRET_SUCCESS;
+			singleApp = 1;
+		}
+    }
+
+    /* The checksum verified by the bootloader is the one of the active application,
+     * only compare it when there is a single one */
+    if ((CYRET_SUCCESS == err) && (PROGRAM == action) && (session->flags & CYBTLDR_FLAG_SKIP_UP_TO_DATE)
+        && singleApp && (blVer >= BL_VER_SUPPORT_VERIFY))
+    {
+        err = CyBtldr_CheckUpToDate(session, image);
         if (CYRET_SUCCESS == err)
+            session->upToDate = 1;
+        else if ((CYRET_ERR_CHECKSUM == err) || (CYRET_ERR_BTLDR_MASK & err))
+            err = CYRET_SUCCESS; /* The device has to be programmed */
+    }
+
+    if ((CYRET_SUCCESS == err) && (PROGRAM == action) && resume && session->resumeRow && !session->upToDate)
+    {
+        err = CyBtldr_FindResumeRow(session, image, &startRow);
+        session->resumedRow = startRow;
+        /* The progress only counts the rows left to program */
+        session->progress.rowCount -= startRow;
+        for (rowIdx = 0; rowIdx < startRow; rowIdx++)
+            session->progress.byteCount -= image->rows[rowIdx].size;
+    }
+
+    if (CYRET_SUCCESS != err)
+        return err;
+
+    *rowsRun = 1;
+    for (rowIdx = startRow; (CYRET_SUCCESS == err) && !session->upToDate && (rowIdx < image->rowCount); rowIdx++)
+    {
+        if (session->abort)
         {
-            CyBtldr_SetCheckSumType(chksumtype);
-            err = CyBtldr_StartBootloadOperation(comm, siliconId, siliconRev, &blVer, securityKey);
-            bootloaderEntered = 1;
+            err = CYRET_ABORT;
+            break;
         }
 
-        appId -= 1; /* 1 and 2 are legal inputs to function. 0 and 1 are valid for bootloader component */
-        if (appId > 1)
+        row = &image->rows[rowIdx];
+        switch (action)
+        {
+            case ERASE:
+                err = CyBtldr_EraseRow(session, row->arrayId, row->rowNum);
+                break;
+            case PROGRAM:
+                if (deltaProgram)
+                {
+                    /* Leave the row alone if the device already holds it */
+                    checksum2 = CyBtldr_RowChecksum(row->checksum, row->arrayId, row->rowNum, row->size);
+                    err = CyBtldr_VerifyRow(session, row->arrayId, row->rowNum, checksum2);
+                    if (CYRET_SUCCESS == err)
+                    {
+                        session->skippedRows++;
+                        break;
+                    }
+                    if (CYRET_ERR_CHECKSUM != err)
+                        break;
+                }
+                err = CyBtldr_ProgramRow(session, row->arrayId, row->rowNum, row->data, row->size);
+                if (CYRET_SUCCESS != err || fastProgram)
+                    break;
+                /* Continue on to verify the row that was programmed */
+            case VERIFY:
+                checksum2 = CyBtldr_RowChecksum(row->checksum, row->arrayId, row->rowNum, row->size);
+                err = CyBtldr_VerifyRow(session, row->arrayId, row->rowNum, checksum2);
+                break;
+        }
+        if (CYRET_SUCCESS != err)
+        {
+            session->errRowValid = 1;
+            session->errRowIdx = rowIdx;
+            session->errArrayId = row->arrayId;
+            session->errRowNum = row->rowNum;
+        }
+        else
         {
-            appId = INVALID_APP;
+            session->progress.rowsDone++;
+            session->progress.bytesDone += row->size;
+            if (NULL != update)
+                update(session, row->arrayId, row->rowNum);
         }
+    }
 
-        if ((CYRET_SUCCESS == err) && (appId != INVALID_APP))
+    if (CYRET_SUCCESS == err)
+    {
+        /* Set the active application to what was just programmed */
+        if ((PROGRAM == action) && (INVALID_APP != appId))
         {
-			/* This will return error if bootloader is for single app */
-            err = CyBtldr_GetApplicationStatus(appId, &isValid, &isActive);
+            err = CyBtldr_GetApplicationStatus(session, appId, &isValid, &isActive);
 
-            /* Active app can be verified, but not programmed or erased */
-            if (CYRET_SUCCESS == err && VERIFY != action && isActive)
-			{
+            if (CYRET_SUCCESS == err)
+            {
+                /* If valid set the active application to what was just programmed */
 				/* This is multi app */
-				err = CYRET_ERR_ACTIVE;
-			}
+                err = (0 == isValid)
+                    ? CyBtldr_SetApplicationStatus(session, appId)
+                    : CYRET_ERR_CHECKSUM;
+            }
 			else if (CYBTLDR_STAT_ERR_CMD == (err ^ (int)CYRET_ERR_BTLDR_MASK))
 			{
 				/* Single app - restore previous CYRET_SUCCESS */
 				err = CYRET_SUCCESS;
+				/* Rows were not all verified, check the application instead */
+				if (fastProgram || deltaProgram || startRow)
+					err = CyBtldr_VerifyApplication(session);
 			}
         }
 
-        if (CYRET_SUCCESS == err)
-        {
-            while (CYRET_SUCCESS == err)
-            {
-                if (g_abort)
-                {
-                    err = CYRET_ABORT;
-                    break;
-                }
+        /* Verify that the entire application is valid */
+        else if ((PROGRAM == action || VERIFY == action) && (blVer >= BL_VER_SUPPORT_VERIFY))
+            err = CyBtldr_VerifyApplication(session);
 
-                err = CyBtldr_ReadLine(&lineLen, line);
-                if (CYRET_SUCCESS == err)
-                    err = CyBtldr_ParseRowData(lineLen, line, &arrayId, &rowNum, buffer, &bufSize, &checksum);
-                if (CYRET_SUCCESS == err)
-                {
-                    switch (action)
-                    {
-                        case ERASE:
-                            err = CyBtldr_EraseRow(arrayId, rowNum);
-                            break;
-                        case PROGRAM:
-                            err = CyBtldr_ProgramRow(arrayId, rowNum, buffer, bufSize);
-                            if (CYRET_SUCCESS != err)
-                                break;
-                            /* Continue on to verify the row that was programmed */
-                        case VERIFY:
-                            checksum2 = (unsigned char)(checksum + arrayId + rowNum + (rowNum >> 8) + bufSize + (bufSize >> 8));
-                            err = CyBtldr_VerifyRow(arrayId, rowNum, checksum2);
-                            break;
-                    }
-                    if (CYRET_SUCCESS == err && NULL != update)
-                        update(arrayId, rowNum);
-                }
-                else if (CYRET_ERR_EOF == err)
-                {
-                    err = CYRET_SUCCESS;
-                    break;
-                }
-            }
+        /* Rows were not verified while programming, find the bad one */
+        if (fastProgram && CYRET_ERR_CHECKSUM == err)
+            err = CyBtldr_LocateBadRow(session, image);
+    }
 
-            if (CYRET_SUCCESS == err)
-            {
-                /* Set the active application to what was just programmed */
-                if ((PROGRAM == action) && (INVALID_APP != appId))
-                {
-                    err = CyBtldr_GetApplicationStatus(appId, &isValid, &isActive);
+    return err;
+}
 
-                    if (CYRET_SUCCESS == err)
-                    {
-                        /* If valid set the active application to what was just programmed */
-						/* This is multi app */
-                        err = (0 == isValid)
-                            ? CyBtldr_SetApplicationStatus(appId)
-                            : CYRET_ERR_CHECKSUM;
-                    }
-					else if (CYBTLDR_STAT_ERR_CMD == (err ^ (int)CYRET_ERR_BTLDR_MASK))
-					{
-						/* Single app - restore previous CYRET_SUCCESS */
-						err = CYRET_SUCCESS;
-					}
-                }
+int CyBtldr_RunSteps(CyBtldr_Session* session, const CyBtldr_Step* steps, unsigned int count,
+    const unsigned char* securityKey, CyBtldr_ProgressUpdate* update)
+{
+    const CyBtldr_Image* image;
+    unsigned long blVer = 0;
+    unsigned char program = 0;
+    unsigned char rowsRun = 0;
+    unsigned int rowIdx;
+    unsigned int i;
+    int err;
 
-                /* Verify that the entire application is valid */
-                else if ((PROGRAM == action || VERIFY == action) && (blVer >= BL_VER_SUPPORT_VERIFY))
-                    err = CyBtldr_VerifyApplication();
-            }
+    if ((NULL == steps) || (0 == count))
+        return CYRET_ERR_ARG;
+    image = steps[0].image;
 
-            CyBtldr_EndBootloadOperation();
-        }
-        else if (CYRET_ERR_COMM_MASK != (CYRET_ERR_COMM_MASK & err) && bootloaderEntered)
-            CyBtldr_EndBootloadOperation();
+    session->abort = 0;
+    session->errRowValid = 0;
+    session->skippedRows = 0;
+    session->resumedRow = 0;
+    session->upToDate = 0;
+    session->transferSizeFallback = 0;
+    session->retries = 0;
+    session->step = 0;
+    memset(&session->progress, 0, sizeof(session->progress));
+    for (i = 0; i < count; i++)
+    {
+        session->progress.rowCount += steps[i].image->rowCount;
+        for (rowIdx = 0; rowIdx < steps[i].image->rowCount; rowIdx++)
+            session->progress.byteCount += steps[i].image->rows[rowIdx].size;
+        program |= (PROGRAM == steps[i].action);
+    }
 
-        CyBtldr_CloseDataFile();
+    CyBtldr_SetCheckSumType(session, image->checksumType);
+    err = CyBtldr_StartBootloadOperation(session, image->siliconId, image->siliconRev, &blVer, securityKey);
+    /* A transfer size of 0 asks for the biggest one the bootloader accepts */
+    if ((CYRET_SUCCESS == err) && program && (0 == session->comm->MaxTransferSize))
+    {
+        err = CyBtldr_ProbeTransferSize(session);
+        session->transferSizeFallback = (CYRET_ERR_LENGTH == err);
+        if (session->transferSizeFallback)
+            err = CYRET_SUCCESS;
     }
 
+    for (i = 0; (CYRET_SUCCESS == err) && (i < count); i++)
+    {
+        session->step = i;
+        /* The device entered is the one of the first image */
+        if (steps[i].image->siliconId != image->siliconId || steps[i].image->siliconRev != image->siliconRev
+            || steps[i].image->checksumType != image->checksumType)
+            err = CYRET_ERR_DEVICE;
+        else
+            err = CyBtldr_RunStep(session, &steps[i], blVer, 1 == count, update, &rowsRun);
+    }
+
+    /* The bootloader is not left after a communication error before any row */
+    if (rowsRun || CYRET_ERR_COMM_MASK != (CYRET_ERR_COMM_MASK & err))
+        CyBtldr_EndBootloadOperation(session);
+
     return err;
 }
 
-int CyBtldr_Program(const char* file, const unsigned char* securityKey, unsigned char appId,
-    CyBtldr_CommunicationsData* comm, CyBtldr_ProgressUpdate* update)
+int CyBtldr_Program(CyBtldr_Session* session, const char* file, const unsigned char* securityKey, unsigned char appId,
+    CyBtldr_ProgressUpdate* update)
 {
-    return CyBtldr_RunAction(PROGRAM, file, securityKey, appId, comm, update);
+    return CyBtldr_RunAction(session, PROGRAM, file, securityKey, appId, update);
 }
 
-int CyBtldr_Erase(const char* file, const unsigned char* securityKey, CyBtldr_CommunicationsData* comm, 
+int CyBtldr_Erase(CyBtldr_Session* session, const char* file, const unsigned char* securityKey, 
     CyBtldr_ProgressUpdate* update)
 {
-    return CyBtldr_RunAction(ERASE, file, securityKey, 0, comm, update);
+    return CyBtldr_RunAction(session, ERASE, file, securityKey, 0, update);
 }
 
-int CyBtldr_Verify(const char* file, const unsigned char* securityKey, CyBtldr_CommunicationsData* comm, 
+int CyBtldr_Verify(CyBtldr_Session* session, const char* file, const unsigned char* securityKey, 
     CyBtldr_ProgressUpdate* update)
 {
-    return CyBtldr_RunAction(VERIFY, file, securityKey, 0, comm, update);
+    return CyBtldr_RunAction(session, VERIFY, file, securityKey, 0, update);
 }
 
-int CyBtldr_Abort(void)
+int CyBtldr_Abort(CyBtldr_Session* session)
 {
-    g_abort = 1;
+    session->abort = 1;
     return CYRET_SUCCESS;
 }
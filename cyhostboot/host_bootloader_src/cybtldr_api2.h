@@ -8,7 +8,8 @@
 #ifndef __CYBTLDR_API2_H__
 #define __CYBTLDR_API2_H__
 
-#include "cybtldr_utils.h"
+#include "cybtldr_session.h"
+#include "cybtldr_parse.h"
 
 /*
  * This enum defines the different operations that can be performed
@@ -24,22 +25,39 @@ typedef enum
     VERIFY,
 } CyBtldr_Action;
 
-/* Function used to notify caller that a row was finished */
-typedef void CyBtldr_ProgressUpdate(unsigned char arrayId, unsigned short rowNum);
+/*
+ * This struct defines one of the actions run in a single bootloader session
+ * by CyBtldr_RunSteps.
+ */
+typedef struct
+{
+    /* The action to execute */
+    CyBtldr_Action action;
+    /* The content of the *.cyacd file to execute it with */
+    const CyBtldr_Image* image;
+    /* The application number to use. 1 for app1, 2 for app2, else noop */
+    unsigned char appId;
+} CyBtldr_Step;
+
+/* Function used to notify caller that a row was finished, session->progress
+ * holds the amount of work done and the total */
+typedef void CyBtldr_ProgressUpdate(CyBtldr_Session* session, unsigned char arrayId, unsigned short rowNum);
 
 
 /*******************************************************************************
 * Function Name: CyBtldr_RunAction
 ********************************************************************************
 * Summary:
-*   
+*   Loads the *.cyacd file with CyBtldr_LoadImage, then runs an action on the
+*   device with CyBtldr_RunActionImage.  Nothing is sent to the device if the
+*   file is invalid.
 *
 * Parameters:
+*   session     - The session to run the operation on
 *   action      - The action to execute
 *   file        - The full canonical path to the *.cyacd file to open
 *   securityKey - The 6 byte or null security key used to authenticate with bootloader component
 *   appId       - The application number to run when programming finishes. 1 for app1, 2 for app2, else noop
-*   comm        - Communication struct used for communicating with the target device
 *   update      - Optional function pointer to use to notify of progress updates
 *
 * Returns:
@@ -51,13 +69,89 @@ typedef void CyBtldr_ProgressUpdate(unsigned char arrayId, unsigned short rowNum
 *   CYRET_ERR_ARRAY	    - The array is not valid for programming
 *   CYRET_ERR_ROW	    - The array/row number is not valid for programming
 *   CYRET_ERR_CHECKSUM  - The checksum does not match the expected value
+*   CYRET_ERR_FILE      - The file could not be read or is not valid
+*   CYRET_ERR_BTLDR	    - The bootloader experienced an error
+*   CYRET_ERR_COMM	    - There was a communication error talking to the device
+*   CYRET_ABORT		    - The operation was aborted
+*
+*******************************************************************************/
+int CyBtldr_RunAction(CyBtldr_Session* session, CyBtldr_Action action, const char* file, const unsigned char* securityKey, 
+    unsigned char appId, CyBtldr_ProgressUpdate* update);
+
+/*******************************************************************************
+* Function Name: CyBtldr_RunActionImage
+********************************************************************************
+* Summary:
+*   Runs an action on the device with the rows of an image loaded by
+*   CyBtldr_LoadImage.  The image is only read, so the same image can be
+*   used by several sessions at once.  When session->resumeRow is set, a
+*   program operation checks that the last rows before it are on the device
+*   and continues from there.
+*
+* Parameters:
+*   session     - The session to run the operation on
+*   action      - The action to execute
+*   image       - The content of the *.cyacd file
+*   securityKey - The 6 byte or null security key used to authenticate with bootloader component
+*   appId       - The application number to run when programming finishes. 1 for app1, 2 for app2, else noop
+*   update      - Optional function pointer to use to notify of progress updates
+*
+* Returns:
+*   CYRET_SUCCESS	    - The device was programmed successfully
+*   CYRET_ERR_DEVICE	- The detected device does not match the desired device
+*   CYRET_ERR_VERSION	- The detected bootloader version is not compatible
+*   CYRET_ERR_LENGTH	- The result packet does not have enough data
+*   CYRET_ERR_DATA	    - The result packet does not contain valid data
+*   CYRET_ERR_ARRAY	    - The array is not valid for programming
+*   CYRET_ERR_ROW	    - The array/row number is not valid for programming
+*   CYRET_ERR_CHECKSUM  - The checksum does not match the expected value
+*   CYRET_ERR_BTLDR	    - The bootloader experienced an error
+*   CYRET_ERR_COMM	    - There was a communication error talking to the device
+*   CYRET_ABORT		    - The operation was aborted
+*
+*******************************************************************************/
+int CyBtldr_RunActionImage(CyBtldr_Session* session, CyBtldr_Action action, const CyBtldr_Image* image, const unsigned char* securityKey, 
+    unsigned char appId, CyBtldr_ProgressUpdate* update);
+
+/*******************************************************************************
+* Function Name: CyBtldr_RunSteps
+********************************************************************************
+* Summary:
+*   Runs several actions in order within a single bootloader session, as
+*   CyBtldr_RunActionImage runs one: the device is entered and its transfer
+*   size probed once for all of them, then left once the last one is done or
+*   one fails.  This programs both applications of a dual application
+*   bootloader, or erases then programs a device, without the setup of a
+*   new session for each step.  All the images must be for the same device
+*   and use the same packet checksum.  The progress covers the rows of all
+*   the steps, session->step tells which step failed, and session->resumeRow
+*   is only used when there is a single step.
+*
+* Parameters:
+*   session     - The session to run the operation on
+*   steps       - The actions to execute, with their image and application
+*   count       - The number of steps
+*   securityKey - The 6 byte or null security key used to authenticate with bootloader component
+*   update      - Optional function pointer to use to notify of progress updates
+*
+* Returns:
+*   CYRET_SUCCESS	    - All the steps were executed successfully
+*   CYRET_ERR_ARG	    - There is no step to execute
+*   CYRET_ERR_DEVICE	- The detected device does not match the desired device,
+*                         or the images are not all for the same device
+*   CYRET_ERR_VERSION	- The detected bootloader version is not compatible
+*   CYRET_ERR_LENGTH	- The result packet does not have enough data
+*   CYRET_ERR_DATA	    - The result packet does not contain valid data
+*   CYRET_ERR_ARRAY	    - The array is not valid for programming
+*   CYRET_ERR_ROW	    - The array/row number is not valid for programming
+*   CYRET_ERR_CHECKSUM  - The checksum does not match the expected value
 *   CYRET_ERR_BTLDR	    - The bootloader experienced an error
 *   CYRET_ERR_COMM	    - There was a communication error talking to the device
 *   CYRET_ABORT		    - The operation was aborted
 *
 *******************************************************************************/
-int CyBtldr_RunAction(CyBtldr_Action action, const char* file, const unsigned char* securityKey, 
-    unsigned char appId, CyBtldr_CommunicationsData* comm, CyBtldr_ProgressUpdate* update);
+int CyBtldr_RunSteps(CyBtldr_Session* session, const CyBtldr_Step* steps, unsigned int count,
+    const unsigned char* securityKey, CyBtldr_ProgressUpdate* update);
 
 /*******************************************************************************
 * Function Name: CyBtldr_Program
@@ -67,10 +161,10 @@ int CyBtldr_RunAction(CyBtldr_Action action, const char* file, const unsigned ch
 *   the contents of the provided *.cyacd file.
 *
 * Parameters:
+*   session     - The session to run the operation on
 *   file        - The full canonical path to the *.cyacd file to open
 *   securityKey - The 6 byte or null security key used to authenticate with bootloader component
 *   appId       - The application number to run when programming finishes. 1 for app1, 2 for app2, else noop
-*   comm        - Communication struct used for communicating with the target device
 *   update      - Optional function pointer to use to notify of progress updates
 *
 * Returns:
@@ -86,8 +180,8 @@ int CyBtldr_RunAction(CyBtldr_Action action, const char* file, const unsigned ch
 *   CYRET_ABORT		    - The operation was aborted
 *
 *******************************************************************************/
-EXTERN int CALL_CON CyBtldr_Program(const char* file, const unsigned char* securityKey, 
-    unsigned char appId, CyBtldr_CommunicationsData* comm, CyBtldr_ProgressUpdate* update);
+EXTERN int CALL_CON CyBtldr_Program(CyBtldr_Session* session, const char* file, const unsigned char* securityKey, 
+    unsigned char appId, CyBtldr_ProgressUpdate* update);
 
 /*******************************************************************************
 * Function Name: CyBtldr_Erase
@@ -98,9 +192,9 @@ EXTERN int CALL_CON CyBtldr_Program(const char* file, const unsigned char* secur
 *   
 *
 * Parameters:
+*   session     - The session to run the operation on
 *   file         The full canonical path to the *.cyacd file to open
 *   securityKey - The 6 byte or null security key used to authenticate with bootloader component
-*   comm         Communication struct used for communicating with the target device
 *   update      - Optional function pointer to use to notify of progress updates
 *
 * Returns:
@@ -116,8 +210,8 @@ EXTERN int CALL_CON CyBtldr_Program(const char* file, const unsigned char* secur
 *   CYRET_ABORT		    - The operation was aborted
 *
 *******************************************************************************/
-EXTERN int CALL_CON CyBtldr_Erase(const char* file, const unsigned char* securityKey, 
-    CyBtldr_CommunicationsData* comm, CyBtldr_ProgressUpdate* update);
+EXTERN int CALL_CON CyBtldr_Erase(CyBtldr_Session* session, const char* file, const unsigned char* securityKey, 
+    CyBtldr_ProgressUpdate* update);
 
 /*******************************************************************************
 * Function Name: CyBtldr_Verify
@@ -133,9 +227,9 @@ EXTERN int CALL_CON CyBtldr_Erase(const char* file, const unsigned char* securit
 *   occurred.
 *
 * Parameters:
+*   session     - The session to run the operation on
 *   file         The full canonical path to the *.cyacd file to open
 *   securityKey - The 6 byte or null security key for authenticatication with bootloader component
-*   comm         Communication struct used for communicating with the target device
 *   update      - Optional function pointer to use to notify of progress updates
 *
 * Returns:
@@ -152,26 +246,26 @@ EXTERN int CALL_CON CyBtldr_Erase(const char* file, const unsigned char* securit
 *   CYRET_ABORT		    - The operation was aborted
 *
 *******************************************************************************/
-EXTERN int CALL_CON CyBtldr_Verify(const char* file, const unsigned char* securityKey, 
-    CyBtldr_CommunicationsData* comm, CyBtldr_ProgressUpdate* update);
+EXTERN int CALL_CON CyBtldr_Verify(CyBtldr_Session* session, const char* file, const unsigned char* securityKey, 
+    CyBtldr_ProgressUpdate* update);
 
 /*******************************************************************************
 * Function Name: CyBtldr_Abort
 ********************************************************************************
 * Summary:
 *  This function aborts the current operation, whether it be Programming, 
-*  Erasing, or Verifying.  This is done by setting a global flag that the 
-*  Program, Erase & Verify operations check at the end of each row operation.  
+*  Erasing, or Verifying.  This is done by setting a flag in the session that 
+*  the Program, Erase & Verify operations check at the end of each row operation.  
 *  Since all calls are blocking, this will need to be called from a different 
 *  execution thread.
 *
 * Parameters:
-*   void.
+*   session - The session to abort the operation of
 *
 * Returns:
 *   CYRET_SUCCESS	    - The abort was sent successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_Abort(void);
+EXTERN int CyBtldr_Abort(CyBtldr_Session* session);
 
 #endif
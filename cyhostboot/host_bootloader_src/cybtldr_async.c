@@ -0,0 +1,235 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "cybtldr_async.h"
+
+unsigned long long CyBtldr_AsyncNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* Suspend the operation until one of the events or the deadline, returns
+ * whether the deadline passed */
+static int CyBtldr_AsyncWait(CyBtldr_AsyncOperation* op, unsigned char events, unsigned long long deadline)
+{
+    /* A cancelled operation is never suspended again */
+    if (op->cancelled)
+        return 1;
+
+    op->events = events;
+    op->deadline = deadline;
+    op->timedOut = 0;
+    swapcontext(&op->context, &op->callerContext);
+    op->events = 0;
+    op->deadline = 0;
+
+    return op->cancelled || op->timedOut || CyBtldr_AsyncNow() >= deadline;
+}
+
+/* Switch to the operation until it waits again or returns, which switches
+ * back to the caller through uc_link */
+static void CyBtldr_AsyncResume(CyBtldr_AsyncOperation* op)
+{
+    swapcontext(&op->callerContext, &op->context);
+
+    /* The stack is no longer needed once the operation returned */
+    if (op->done && NULL != op->stack)
+    {
+        free(op->stack);
+        op->stack = NULL;
+    }
+}
+
+/* Communication functions of the session while the operation runs, they
+ * suspend the operation where the non-blocking ones would block */
+static int CyBtldr_AsyncOpenConnection(void* ctx)
+{
+    CyBtldr_AsyncOperation* op = (CyBtldr_AsyncOperation*)ctx;
+
+    return op->asyncComm->OpenConnection(op->asyncComm->Context);
+}
+
+static int CyBtldr_AsyncCloseConnection(void* ctx)
+{
+    CyBtldr_AsyncOperation* op = (CyBtldr_AsyncOperation*)ctx;
+
+    return op->asyncComm->CloseConnection(op->asyncComm->Context);
+}
+
+static int CyBtldr_AsyncTransfer(CyBtldr_AsyncOperation* op, int (*transfer)(void*, unsigned char*, int),
+    unsigned char events, unsigned char* buf, int size)
+{
+    CyBtldr_AsyncCommunications* comm = op->asyncComm;
+    unsigned long long deadline = CyBtldr_AsyncNow() + comm->GetTimeout(comm->Context);
+    int err;
+
+    if (op->cancelled)
+        return CYRET_ABORT;
+
+    while (CYRET_AGAIN == (err = transfer(comm->Context, buf, size)))
+    {
+        if (CyBtldr_AsyncWait(op, events, deadline))
+            return op->cancelled ? CYRET_ABORT : comm->TimedOut(comm->Context);
+    }
+
+    return err;
+}
+
+static int CyBtldr_AsyncReadData(void* ctx, unsigned char* buf, int size)
+{
+    CyBtldr_AsyncOperation* op = (CyBtldr_AsyncOperation*)ctx;
+
+    return CyBtldr_AsyncTransfer(op, op->asyncComm->ReadData, CYBTLDR_ASYNC_READABLE, buf, size);
+}
+
+static int CyBtldr_AsyncWriteData(void* ctx, unsigned char* buf, int size)
+{
+    CyBtldr_AsyncOperation* op = (CyBtldr_AsyncOperation*)ctx;
+
+    return CyBtldr_AsyncTransfer(op, op->asyncComm->WriteData, CYBTLDR_ASYNC_WRITABLE, buf, size);
+}
+
+static void CyBtldr_AsyncDelay(void* ctx, unsigned int milliseconds)
+{
+    CyBtldr_AsyncOperation* op = (CyBtldr_AsyncOperation*)ctx;
+
+    CyBtldr_AsyncWait(op, 0, CyBtldr_AsyncNow() + milliseconds);
+}
+
+static int CyBtldr_AsyncRunAction(CyBtldr_Session* session, void* arg)
+{
+    CyBtldr_AsyncOperation* op = (CyBtldr_AsyncOperation*)arg;
+
+    return CyBtldr_RunActionImage(session, op->action, op->image, op->securityKey, op->appId, op->update);
+}
+
+/* Entry point of the operation stack, the operation pointer is split in two
+ * as makecontext only passes int arguments */
+static void CyBtldr_AsyncMain(unsigned int high, unsigned int low)
+{
+    CyBtldr_AsyncOperation* op = (CyBtldr_AsyncOperation*)(uintptr_t)(((unsigned long long)high << 32) | low);
+    CyBtldr_CommunicationsData* prevComm = op->session->comm;
+
+    op->session->comm = &op->comm;
+    op->result = op->func(op->session, op->arg);
+    op->session->comm = prevComm;
+    op->asyncComm->MaxTransferSize = op->comm.MaxTransferSize;
+    op->done = 1;
+}
+
+int CyBtldr_AsyncRun(CyBtldr_AsyncOperation* op, CyBtldr_Session* session, CyBtldr_AsyncCommunications* comm,
+    CyBtldr_AsyncFunc* func, void* arg)
+{
+    unsigned long long ptr = (uintptr_t)op;
+
+    op->asyncComm = comm;
+    op->session = session;
+    op->func = func;
+    op->arg = arg;
+    op->events = 0;
+    op->deadline = 0;
+    op->done = 0;
+    op->cancelled = 0;
+    op->result = CYRET_AGAIN;
+
+    op->comm.OpenConnection = CyBtldr_AsyncOpenConnection;
+    op->comm.CloseConnection = CyBtldr_AsyncCloseConnection;
+    op->comm.ReadData = CyBtldr_AsyncReadData;
+    op->comm.WriteData = CyBtldr_AsyncWriteData;
+    op->comm.Delay = CyBtldr_AsyncDelay;
+    op->comm.MaxTransferSize = comm->MaxTransferSize;
+    op->comm.Context = op;
+
+    op->stack = malloc(CYBTLDR_ASYNC_STACK_SIZE);
+    if (NULL == op->stack || 0 != getcontext(&op->context))
+    {
+        free(op->stack);
+        op->stack = NULL;
+        return CYRET_ERR_UNK;
+    }
+    op->context.uc_stack.ss_sp = op->stack;
+    op->context.uc_stack.ss_size = CYBTLDR_ASYNC_STACK_SIZE;
+    op->context.uc_link = &op->callerContext;
+    makecontext(&op->context, (void (*)(void))CyBtldr_AsyncMain, 2,
+        (unsigned int)(ptr >> 32), (unsigned int)ptr);
+
+    CyBtldr_AsyncResume(op);
+
+    return CYRET_SUCCESS;
+}
+
+int CyBtldr_AsyncStart(CyBtldr_AsyncOperation* op, CyBtldr_Session* session, CyBtldr_AsyncCommunications* comm,
+    CyBtldr_Action action, const CyBtldr_Image* image, const unsigned char* securityKey, unsigned char appId,
+    CyBtldr_ProgressUpdate* update)
+{
+    op->action = action;
+    op->image = image;
+    op->securityKey = securityKey;
+    op->appId = appId;
+    op->update = update;
+
+    return CyBtldr_AsyncRun(op, session, comm, CyBtldr_AsyncRunAction, op);
+}
+
+void CyBtldr_AsyncOnReadable(CyBtldr_AsyncOperation* op)
+{
+    if (!op->done && (op->events & CYBTLDR_ASYNC_READABLE))
+        CyBtldr_AsyncResume(op);
+}
+
+void CyBtldr_AsyncOnWritable(CyBtldr_AsyncOperation* op)
+{
+    if (!op->done && (op->events & CYBTLDR_ASYNC_WRITABLE))
+        CyBtldr_AsyncResume(op);
+}
+
+void CyBtldr_AsyncOnTimeout(CyBtldr_AsyncOperation* op)
+{
+    if (!op->done && op->deadline && CyBtldr_AsyncNow() >= op->deadline)
+    {
+        op->timedOut = 1;
+        CyBtldr_AsyncResume(op);
+    }
+}
+
+void CyBtldr_AsyncCancel(CyBtldr_AsyncOperation* op)
+{
+    if (!op->done && NULL != op->stack)
+    {
+        /* Let the operation return, each transfer it starts failing at once */
+        op->cancelled = 1;
+        op->session->abort = 1;
+        CyBtldr_AsyncResume(op);
+        op->asyncComm->CloseConnection(op->asyncComm->Context);
+    }
+
+    free(op->stack);
+    op->stack = NULL;
+}
+
+int CyBtldr_AsyncPollStatus(CyBtldr_AsyncOperation* op, int* handle, unsigned char* events, int* timeout)
+{
+    unsigned long long now;
+
+    *handle = -1;
+    *events = 0;
+    *timeout = -1;
+    if (op->done)
+        return op->result;
+
+    if (op->events)
+    {
+        *handle = op->asyncComm->GetHandle(op->asyncComm->Context);
+        *events = op->events;
+    }
+    if (op->deadline)
+    {
+        now = CyBtldr_AsyncNow();
+        *timeout = (op->deadline > now) ? (int)(op->deadline - now) : 0;
+    }
+
+    return CYRET_AGAIN;
+}
@@ -0,0 +1,243 @@
+#ifndef __CYBTLDR_ASYNC_H__
+#define __CYBTLDR_ASYNC_H__
+
+#include <ucontext.h>
+
+#include "cybtldr_api2.h"
+
+/* Size of the stack an asynchronous operation runs on */
+#ifndef CYBTLDR_ASYNC_STACK_SIZE
+#define CYBTLDR_ASYNC_STACK_SIZE (128 * 1024)
+#endif
+
+/* Events an asynchronous operation waits for on the handle of its transport */
+#define CYBTLDR_ASYNC_READABLE 0x01
+#define CYBTLDR_ASYNC_WRITABLE 0x02
+
+/*
+ * This struct defines the non-blocking communication protocol used by
+ * asynchronous operations.  Reads and writes return CYRET_AGAIN instead of
+ * blocking, and are called again with the same arguments once the handle is
+ * readable or writable.
+ */
+typedef struct
+{
+    /* Function used to open the communications connection */
+    int (*OpenConnection)(void*);
+    /* Function used to close the communications connection */
+    int (*CloseConnection)(void*);
+    /* Function used to read a whole response, CYRET_AGAIN until it is received */
+    int (*ReadData)(void*, unsigned char*, int);
+    /* Function used to write a whole packet, CYRET_AGAIN until it is sent */
+    int (*WriteData)(void*, unsigned char*, int);
+    /* Function called when a read or write did not complete in time, returns
+     * the error reported for it */
+    int (*TimedOut)(void*);
+    /* Function returning the handle (file descriptor) to wait on */
+    int (*GetHandle)(void*);
+    /* Function returning the time a read or write may take, in milliseconds */
+    int (*GetTimeout)(void*);
+    /* Value used to specify the maximum number of bytes that can be trasfered at a time,
+     * 0 to probe it when programming (see CyBtldr_ProbeTransferSize) */
+    unsigned int MaxTransferSize;
+    /* User pointer passed as first argument to all of the above functions */
+    void* Context;
+} CyBtldr_AsyncCommunications;
+
+/* Function run by CyBtldr_AsyncRun */
+typedef int CyBtldr_AsyncFunc(CyBtldr_Session* session, void* arg);
+
+/*
+ * This struct holds the state of an operation run on a session without
+ * blocking.  The operation runs on its own stack and is suspended whenever
+ * it would wait for the device, so that a single thread can drive many of
+ * them from its event loop.
+ */
+typedef struct
+{
+    /* Communication struct of the session while the operation runs */
+    CyBtldr_CommunicationsData comm;
+    /* Non-blocking communication struct it relies on */
+    CyBtldr_AsyncCommunications* asyncComm;
+    CyBtldr_Session* session;
+    CyBtldr_AsyncFunc* func;
+    void* arg;
+    /* Arguments of CyBtldr_RunActionImage for CyBtldr_AsyncStart */
+    CyBtldr_Action action;
+    const CyBtldr_Image* image;
+    const unsigned char* securityKey;
+    unsigned char appId;
+    CyBtldr_ProgressUpdate* update;
+    /* Contexts of the operation and of the caller resuming it, which switch
+     * to each other */
+    ucontext_t context;
+    ucontext_t callerContext;
+    void* stack;
+    /* What the operation waits for: events and deadline in milliseconds on
+     * the CyBtldr_AsyncNow clock (0 for none) */
+    unsigned char events;
+    unsigned long long deadline;
+    unsigned char timedOut;
+    unsigned char cancelled;
+    unsigned char done;
+    int result;
+} CyBtldr_AsyncOperation;
+
+/*******************************************************************************
+* Function Name: CyBtldr_AsyncStart
+********************************************************************************
+* Summary:
+*   Starts CyBtldr_RunActionImage on a session without blocking.  The
+*   operation runs until it has to wait for the device, then returns.  It is
+*   resumed by CyBtldr_AsyncOnReadable, CyBtldr_AsyncOnWritable and
+*   CyBtldr_AsyncOnTimeout, and CyBtldr_AsyncPollStatus tells what it waits
+*   for and its result once done.  The image and the key must stay valid
+*   until then.
+*
+* Parameters:
+*   op          - The operation to start
+*   session     - The session to run the operation on
+*   comm        - The non-blocking communication struct to use
+*   action      - The action to execute
+*   image       - The content of the *.cyacd file
+*   securityKey - The 6 byte or null security key used to authenticate with bootloader component
+*   appId       - The application number to run when programming finishes. 1 for app1, 2 for app2, else noop
+*   update      - Optional function pointer to use to notify of progress updates
+*
+* Returns:
+*   CYRET_SUCCESS   - The operation was started
+*   CYRET_ERR_UNK   - The operation could not be allocated
+*
+*******************************************************************************/
+EXTERN int CyBtldr_AsyncStart(CyBtldr_AsyncOperation* op, CyBtldr_Session* session, CyBtldr_AsyncCommunications* comm,
+    CyBtldr_Action action, const CyBtldr_Image* image, const unsigned char* securityKey, unsigned char appId,
+    CyBtldr_ProgressUpdate* update);
+
+/*******************************************************************************
+* Function Name: CyBtldr_AsyncRun
+********************************************************************************
+* Summary:
+*   Starts any function using the session without blocking, as
+*   CyBtldr_AsyncStart does.  The session communication struct is the one of
+*   the operation while the function runs.
+*
+* Parameters:
+*   op      - The operation to start
+*   session - The session to run the operation on
+*   comm    - The non-blocking communication struct to use
+*   func    - The function to run, its return value is the operation result
+*   arg     - The argument passed to func
+*
+* Returns:
+*   CYRET_SUCCESS   - The operation was started
+*   CYRET_ERR_UNK   - The operation could not be allocated
+*
+*******************************************************************************/
+EXTERN int CyBtldr_AsyncRun(CyBtldr_AsyncOperation* op, CyBtldr_Session* session, CyBtldr_AsyncCommunications* comm,
+    CyBtldr_AsyncFunc* func, void* arg);
+
+/*******************************************************************************
+* Function Name: CyBtldr_AsyncOnReadable
+********************************************************************************
+* Summary:
+*   Resumes an operation waiting for its handle to be readable.  Nothing is
+*   done if it waits for something else.
+*
+* Parameters:
+*   op - The operation the handle of which is readable
+*
+* Returns:
+*   NA
+*
+*******************************************************************************/
+EXTERN void CyBtldr_AsyncOnReadable(CyBtldr_AsyncOperation* op);
+
+/*******************************************************************************
+* Function Name: CyBtldr_AsyncOnWritable
+********************************************************************************
+* Summary:
+*   Resumes an operation waiting for its handle to be writable.  Nothing is
+*   done if it waits for something else.
+*
+* Parameters:
+*   op - The operation the handle of which is writable
+*
+* Returns:
+*   NA
+*
+*******************************************************************************/
+EXTERN void CyBtldr_AsyncOnWritable(CyBtldr_AsyncOperation* op);
+
+/*******************************************************************************
+* Function Name: CyBtldr_AsyncOnTimeout
+********************************************************************************
+* Summary:
+*   Resumes an operation the deadline of which has passed.  Nothing is done
+*   if it has not.
+*
+* Parameters:
+*   op - The operation to check
+*
+* Returns:
+*   NA
+*
+*******************************************************************************/
+EXTERN void CyBtldr_AsyncOnTimeout(CyBtldr_AsyncOperation* op);
+
+/*******************************************************************************
+* Function Name: CyBtldr_AsyncCancel
+********************************************************************************
+* Summary:
+*   Cancels a running operation: the session is aborted and the operation
+*   resumed with each of its transfers failing at once until it returns, then
+*   the connection is closed.  The stack of the operation is released, this
+*   must be called on an operation that is not run to completion.  Nothing is
+*   done on an operation that is done.
+*
+* Parameters:
+*   op - The operation to cancel
+*
+* Returns:
+*   NA
+*
+*******************************************************************************/
+EXTERN void CyBtldr_AsyncCancel(CyBtldr_AsyncOperation* op);
+
+/*******************************************************************************
+* Function Name: CyBtldr_AsyncPollStatus
+********************************************************************************
+* Summary:
+*   Tells what a running operation waits for, or the result of a finished
+*   one.
+*
+* Parameters:
+*   op      - The operation to check
+*   handle  - The handle to wait on, -1 if the operation only waits for time
+*   events  - The events to wait for on the handle (CYBTLDR_ASYNC_*)
+*   timeout - Time left before CyBtldr_AsyncOnTimeout must be called, in
+*             milliseconds, -1 if none
+*
+* Returns:
+*   CYRET_AGAIN - The operation is running
+*   Otherwise the result of the operation, as returned by
+*   CyBtldr_RunActionImage
+*
+*******************************************************************************/
+EXTERN int CyBtldr_AsyncPollStatus(CyBtldr_AsyncOperation* op, int* handle, unsigned char* events, int* timeout);
+
+/*******************************************************************************
+* Function Name: CyBtldr_AsyncNow
+********************************************************************************
+* Summary:
+*   Returns the monotonic clock deadlines are based on.
+*
+* Parameters:
+*   NA
+*
+* Returns:
+*   The current time in milliseconds
+*
+*******************************************************************************/
+EXTERN unsigned long long CyBtldr_AsyncNow(void);
+
+#endif
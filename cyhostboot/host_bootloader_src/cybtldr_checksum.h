@@ -0,0 +1,71 @@
+#ifndef __CYBTLDR_CHECKSUM_H__
+#define __CYBTLDR_CHECKSUM_H__
+
+#include "cybtldr_utils.h"
+
+/*
+ * This enum defines the different types of checksums that can be 
+ * used by the bootloader for ensuring data integrety.
+ */
+typedef enum
+{
+    /* Checksum type is a basic inverted summation of all bytes */
+    SUM_CHECKSUM = 0x00,
+    /* 16-bit CRC checksum using the CCITT implementation */
+    CRC_CHECKSUM = 0x01,
+} CyBtldr_ChecksumType;
+
+/* Function computing the packet checksum of a buffer */
+typedef unsigned short CyBtldr_ChecksumFunc(const unsigned char* buf, unsigned long size);
+
+/*******************************************************************************
+* Function Name: CyBtldr_SumChecksum
+********************************************************************************
+* Summary:
+*   Computes the 2's complement of the 16-bit sum of all bytes.  Uses SSE2
+*   when the compiler targets it.
+*
+* Parameters:
+*   buf  - The data to compute the checksum on
+*   size - The number of bytes contained in buf.
+*
+* Returns:
+*   The checksum for the provided data.
+*
+*******************************************************************************/
+EXTERN unsigned short CyBtldr_SumChecksum(const unsigned char* buf, unsigned long size);
+
+/*******************************************************************************
+* Function Name: CyBtldr_CrcChecksum
+********************************************************************************
+* Summary:
+*   Computes the 16-bit CCITT CRC (polynomial 0x8408) of the data, returned
+*   byte swapped as expected in packets.  Processes 4 bytes per step using
+*   lookup tables (slice-by-4).
+*
+* Parameters:
+*   buf  - The data to compute the checksum on
+*   size - The number of bytes contained in buf.
+*
+* Returns:
+*   The checksum for the provided data.
+*
+*******************************************************************************/
+EXTERN unsigned short CyBtldr_CrcChecksum(const unsigned char* buf, unsigned long size);
+
+/*******************************************************************************
+* Function Name: CyBtldr_GetChecksumFunc
+********************************************************************************
+* Summary:
+*   Returns the function computing the given type of checksum.
+*
+* Parameters:
+*   chksumType - The type of checksum
+*
+* Returns:
+*   The checksum function.
+*
+*******************************************************************************/
+EXTERN CyBtldr_ChecksumFunc* CyBtldr_GetChecksumFunc(CyBtldr_ChecksumType chksumType);
+
+#endif
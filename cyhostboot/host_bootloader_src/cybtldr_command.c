@@ -8,51 +8,15 @@
 #include "cybtldr_command.h"
 
 
-/* Variable used to store the currently selected packet checksum type */
-CyBtldr_ChecksumType CyBtldr_Checksum = SUM_CHECKSUM;
-
-unsigned short CyBtldr_ComputeChecksum(unsigned char* buf, unsigned long size)
+unsigned short CyBtldr_ComputeChecksum(CyBtldr_Session* session, unsigned char* buf, unsigned long size)
 {
-    if (CyBtldr_Checksum == CRC_CHECKSUM)
-    {
-	    unsigned short crc = 0xffff;
-	    unsigned short tmp;
-	    int i;
-           
-	    if (size == 0)
-		    return (~crc);
-           
-	    do
-	    {
-		    for (i = 0, tmp = 0x00ff & *buf++; i < 8; i++, tmp >>= 1)
-		    {
-			    if ((crc & 0x0001) ^ (tmp & 0x0001))
-				    crc = (crc >> 1) ^ 0x8408;
-			    else
-			        crc >>= 1;
-		    }
-	    }
-	    while (--size);
-
-	    crc = ~crc;
-        tmp = crc;
-	    crc = (crc << 8) | (tmp >> 8 & 0xFF);
-           
-	    return crc;
-    }
-    else /* SUM_CHECKSUM */
-    {
-        unsigned short sum = 0;
-	    while (size-- > 0)
-		    sum += *buf++;
-    	
-	    return (1 + ~sum);
-    }
+    return session->checksumFunc(buf, size);
 }
 
-void CyBtldr_SetCheckSumType(CyBtldr_ChecksumType chksumType)
+void CyBtldr_SetCheckSumType(CyBtldr_Session* session, CyBtldr_ChecksumType chksumType)
 {
-    CyBtldr_Checksum = chksumType;
+    session->checksumType = chksumType;
+    session->checksumFunc = CyBtldr_GetChecksumFunc(chksumType);
 }
 
 int CyBtldr_ParseDefaultCmdResult(unsigned char* cmdBuf, unsigned long cmdSize, unsigned char* status)
@@ -70,7 +34,7 @@ int CyBtldr_ParseDefaultCmdResult(unsigned char* cmdBuf, unsigned long cmdSize,
     return err;
 }
 
-int CyBtldr_CreateEnterBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize, const unsigned char* securityKeyBuf)
+int CyBtldr_CreateEnterBootLoaderCmd(CyBtldr_Session* session, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize, const unsigned char* securityKeyBuf)
 {
     const unsigned long RESULT_DATA_SIZE = 8;
     const unsigned long BOOTLOADER_SECURITY_KEY_SIZE = 6;
@@ -90,7 +54,7 @@ int CyBtldr_CreateEnterBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSi
     cmdBuf[3] = (unsigned char)(commandDataSize >> 8);
     for (i = 0; i < commandDataSize; i++)
         cmdBuf[i + 4] = securityKeyBuf[i];
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, (*cmdSize) - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, (*cmdSize) - 3);
     cmdBuf[*cmdSize - 3] = (unsigned char)checksum;
     cmdBuf[*cmdSize - 2] = (unsigned char)(checksum >> 8);
     cmdBuf[*cmdSize - 1] = CMD_STOP;
@@ -121,7 +85,7 @@ int CyBtldr_ParseEnterBootLoaderCmdResult(unsigned char* cmdBuf, unsigned long c
     return err;
 }
 
-int CyBtldr_CreateExitBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
+int CyBtldr_CreateExitBootLoaderCmd(CyBtldr_Session* session, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
 {
     unsigned short checksum;
 
@@ -131,7 +95,7 @@ int CyBtldr_CreateExitBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSiz
     cmdBuf[1] = CMD_EXIT_BOOTLOADER;
     cmdBuf[2] = 0;
     cmdBuf[3] = 0;
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, BASE_CMD_SIZE - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, BASE_CMD_SIZE - 3);
     cmdBuf[4] = (unsigned char)checksum;
     cmdBuf[5] = (unsigned char)(checksum >> 8);
     cmdBuf[6] = CMD_STOP;
@@ -139,7 +103,7 @@ int CyBtldr_CreateExitBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSiz
     return CYRET_SUCCESS;
 }
 
-int CyBtldr_CreateProgramRowCmd(unsigned char arrayId, unsigned short rowNum, unsigned char* buf, unsigned short size, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
+int CyBtldr_CreateProgramRowCmd(CyBtldr_Session* session, unsigned char arrayId, unsigned short rowNum, unsigned char* buf, unsigned short size, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
 {
     const unsigned long COMMAND_DATA_SIZE = 3;
     unsigned int checksum;
@@ -156,7 +120,7 @@ int CyBtldr_CreateProgramRowCmd(unsigned char arrayId, unsigned short rowNum, un
     cmdBuf[6] = (unsigned char)(rowNum >> 8);
     for (i = 0; i < size; i++)
         cmdBuf[i + 7] = buf[i];
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, (*cmdSize) - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, (*cmdSize) - 3);
     cmdBuf[*cmdSize - 3] = (unsigned char)checksum;
     cmdBuf[*cmdSize - 2] = (unsigned char)(checksum >> 8);
     cmdBuf[*cmdSize - 1] = CMD_STOP;
@@ -169,7 +133,7 @@ int CyBtldr_ParseProgramRowCmdResult(unsigned char* cmdBuf, unsigned long cmdSiz
     return CyBtldr_ParseDefaultCmdResult(cmdBuf, cmdSize, status);
 }
 
-int CyBtldr_CreateVerifyRowCmd(unsigned char arrayId, unsigned short rowNum, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
+int CyBtldr_CreateVerifyRowCmd(CyBtldr_Session* session, unsigned char arrayId, unsigned short rowNum, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
 {
     const unsigned long RESULT_DATA_SIZE = 1;
     const unsigned long COMMAND_DATA_SIZE = 3;
@@ -185,7 +149,7 @@ int CyBtldr_CreateVerifyRowCmd(unsigned char arrayId, unsigned short rowNum, uns
     cmdBuf[4] = arrayId;
     cmdBuf[5] = (unsigned char)rowNum;
     cmdBuf[6] = (unsigned char)(rowNum >> 8);
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, COMMAND_SIZE - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, COMMAND_SIZE - 3);
     cmdBuf[7] = (unsigned char)checksum;
     cmdBuf[8] = (unsigned char)(checksum >> 8);
     cmdBuf[9] = CMD_STOP;
@@ -214,7 +178,7 @@ int CyBtldr_ParseVerifyRowCmdResult(unsigned char* cmdBuf, unsigned long cmdSize
     return err;
 }
 
-int CyBtldr_CreateEraseRowCmd(unsigned char arrayId, unsigned short rowNum, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
+int CyBtldr_CreateEraseRowCmd(CyBtldr_Session* session, unsigned char arrayId, unsigned short rowNum, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
 {
     const unsigned long COMMAND_DATA_SIZE = 3;
     const unsigned int COMMAND_SIZE = BASE_CMD_SIZE + COMMAND_DATA_SIZE;
@@ -229,7 +193,7 @@ int CyBtldr_CreateEraseRowCmd(unsigned char arrayId, unsigned short rowNum, unsi
     cmdBuf[4] = arrayId;
     cmdBuf[5] = (unsigned char)rowNum;
     cmdBuf[6] = (unsigned char)(rowNum >> 8);
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, COMMAND_SIZE - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, COMMAND_SIZE - 3);
     cmdBuf[7] = (unsigned char)checksum;
     cmdBuf[8] = (unsigned char)(checksum >> 8);
     cmdBuf[9] = CMD_STOP;
@@ -242,7 +206,7 @@ int CyBtldr_ParseEraseRowCmdResult(unsigned char* cmdBuf, unsigned long cmdSize,
     return CyBtldr_ParseDefaultCmdResult(cmdBuf, cmdSize, status);
 }
 
-int CyBtldr_CreateVerifyChecksumCmd(unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
+int CyBtldr_CreateVerifyChecksumCmd(CyBtldr_Session* session, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
 {
     const unsigned long RESULT_DATA_SIZE = 1;
     unsigned short checksum;
@@ -253,7 +217,7 @@ int CyBtldr_CreateVerifyChecksumCmd(unsigned char* cmdBuf, unsigned long* cmdSiz
     cmdBuf[1] = CMD_VERIFY_CHECKSUM;
     cmdBuf[2] = 0;
     cmdBuf[3] = 0;
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, BASE_CMD_SIZE - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, BASE_CMD_SIZE - 3);
     cmdBuf[4] = (unsigned char)checksum;
     cmdBuf[5] = (unsigned char)(checksum >> 8);
     cmdBuf[6] = CMD_STOP;
@@ -282,7 +246,7 @@ int CyBtldr_ParseVerifyChecksumCmdResult(unsigned char* cmdBuf, unsigned long cm
     return err;
 }
 
-int CyBtldr_CreateGetFlashSizeCmd(unsigned char arrayId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
+int CyBtldr_CreateGetFlashSizeCmd(CyBtldr_Session* session, unsigned char arrayId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
 {
     const unsigned long RESULT_DATA_SIZE = 4;
     const unsigned long COMMAND_DATA_SIZE = 1;
@@ -296,7 +260,7 @@ int CyBtldr_CreateGetFlashSizeCmd(unsigned char arrayId, unsigned char* cmdBuf,
     cmdBuf[2] = (unsigned char)COMMAND_DATA_SIZE;
     cmdBuf[3] = (unsigned char)(COMMAND_DATA_SIZE >> 8);
     cmdBuf[4] = arrayId;
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, COMMAND_SIZE - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, COMMAND_SIZE - 3);
     cmdBuf[5] = (unsigned char)checksum;
     cmdBuf[6] = (unsigned char)(checksum >> 8);
     cmdBuf[7] = CMD_STOP;
@@ -326,7 +290,7 @@ int CyBtldr_ParseGetFlashSizeCmdResult(unsigned char* cmdBuf, unsigned long cmdS
     return err;
 }
 
-int CyBtldr_CreateSendDataCmd(unsigned char* buf, unsigned short size, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
+int CyBtldr_CreateSendDataCmd(CyBtldr_Session* session, unsigned char* buf, unsigned short size, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
 {
     unsigned short checksum;
     unsigned long i;
@@ -339,7 +303,7 @@ int CyBtldr_CreateSendDataCmd(unsigned char* buf, unsigned short size, unsigned
     cmdBuf[3] = (unsigned char)(size >> 8);
     for (i = 0; i < size; i++)
         cmdBuf[i + 4] = buf[i];
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, (*cmdSize) - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, (*cmdSize) - 3);
     cmdBuf[(*cmdSize) - 3] = (unsigned char)checksum;
     cmdBuf[(*cmdSize) - 2] = (unsigned char)(checksum >> 8);
     cmdBuf[(*cmdSize) - 1] = CMD_STOP;
@@ -352,7 +316,7 @@ int CyBtldr_ParseSendDataCmdResult(unsigned char* cmdBuf, unsigned long cmdSize,
     return CyBtldr_ParseDefaultCmdResult(cmdBuf, cmdSize, status);
 }
 
-int CyBtldr_CreateSyncBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
+int CyBtldr_CreateSyncBootLoaderCmd(CyBtldr_Session* session, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
 {
     unsigned short checksum;
 
@@ -362,7 +326,7 @@ int CyBtldr_CreateSyncBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSiz
     cmdBuf[1] = CMD_SYNC;
     cmdBuf[2] = 0;
     cmdBuf[3] = 0;
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, BASE_CMD_SIZE - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, BASE_CMD_SIZE - 3);
     cmdBuf[4] = (unsigned char)checksum;
     cmdBuf[5] = (unsigned char)(checksum >> 8);
     cmdBuf[6] = CMD_STOP;
@@ -370,7 +334,7 @@ int CyBtldr_CreateSyncBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSiz
     return CYRET_SUCCESS;
 }
 
-int CyBtldr_CreateGetAppStatusCmd(unsigned char appId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
+int CyBtldr_CreateGetAppStatusCmd(CyBtldr_Session* session, unsigned char appId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
 {
     const unsigned long RESULT_DATA_SIZE = 2;
     const unsigned long COMMAND_DATA_SIZE = 1;
@@ -384,7 +348,7 @@ int CyBtldr_CreateGetAppStatusCmd(unsigned char appId, unsigned char* cmdBuf, un
     cmdBuf[2] = (unsigned char)COMMAND_DATA_SIZE;
     cmdBuf[3] = (unsigned char)(COMMAND_DATA_SIZE >> 8);
     cmdBuf[4] = appId;
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, COMMAND_SIZE - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, COMMAND_SIZE - 3);
     cmdBuf[5] = (unsigned char)checksum;
     cmdBuf[6] = (unsigned char)(checksum >> 8);
     cmdBuf[7] = CMD_STOP;
@@ -414,7 +378,7 @@ int CyBtldr_ParseGetAppStatusCmdResult(unsigned char* cmdBuf, unsigned long cmdS
     return err;
 }
 
-int CyBtldr_CreateSetActiveAppCmd(unsigned char appId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
+int CyBtldr_CreateSetActiveAppCmd(CyBtldr_Session* session, unsigned char appId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize)
 {
     const unsigned long COMMAND_DATA_SIZE = 1;
     const unsigned int COMMAND_SIZE = BASE_CMD_SIZE + COMMAND_DATA_SIZE;
@@ -427,7 +391,7 @@ int CyBtldr_CreateSetActiveAppCmd(unsigned char appId, unsigned char* cmdBuf, un
     cmdBuf[2] = (unsigned char)COMMAND_DATA_SIZE;
     cmdBuf[3] = (unsigned char)(COMMAND_DATA_SIZE >> 8);
     cmdBuf[4] = appId;
-    checksum = CyBtldr_ComputeChecksum(cmdBuf, COMMAND_SIZE - 3);
+    checksum = CyBtldr_ComputeChecksum(session, cmdBuf, COMMAND_SIZE - 3);
     cmdBuf[5] = (unsigned char)checksum;
     cmdBuf[6] = (unsigned char)(checksum >> 8);
     cmdBuf[7] = CMD_STOP;
@@ -440,9 +404,28 @@ int CyBtldr_ParseSetActiveAppCmdResult(unsigned char* cmdBuf, unsigned long cmdS
     return CyBtldr_ParseDefaultCmdResult(cmdBuf, cmdSize, status);
 }
 
+const char* CyBtldr_GetCommandName(unsigned char cmd)
+{
+    switch (cmd)
+    {
+        case CMD_VERIFY_CHECKSUM:   return "verify_checksum";
+        case CMD_GET_FLASH_SIZE:    return "get_flash_size";
+        case CMD_GET_APP_STATUS:    return "get_app_status";
+        case CMD_ERASE_ROW:         return "erase_row";
+        case CMD_SYNC:              return "sync";
+        case CMD_SET_ACTIVE_APP:    return "set_active_app";
+        case CMD_SEND_DATA:         return "send_data";
+        case CMD_ENTER_BOOTLOADER:  return "enter";
+        case CMD_PROGRAM_ROW:       return "program_row";
+        case CMD_VERIFY_ROW:        return "verify_row";
+        case CMD_EXIT_BOOTLOADER:   return "exit";
+        default:                    return "unknown";
+    }
+}
+
 //Try to parse a packet to determine its validity, if valid then return set the status param to the packet's status.
 //Used to generate useful error messages. return 1 on success 0 otherwise.
-int CyBtldr_TryParseParketStatus(unsigned char* packet, int packetSize, unsigned char* status)
+int CyBtldr_TryParseParketStatus(CyBtldr_Session* session, unsigned char* packet, int packetSize, unsigned char* status)
 {
     unsigned short dataSize;
     if (packet == NULL || packetSize < BASE_CMD_SIZE || packet[0] != CMD_START)
@@ -451,7 +434,7 @@ int CyBtldr_TryParseParketStatus(unsigned char* packet, int packetSize, unsigned
     dataSize = packet[2] | (packet[3] << 8);
 
     unsigned short readChecksum = packet[dataSize + 4] | (packet[dataSize + 5] << 8);
-    unsigned short computedChecksum = CyBtldr_ComputeChecksum(packet, BASE_CMD_SIZE + dataSize - 3);
+    unsigned short computedChecksum = CyBtldr_ComputeChecksum(session, packet, BASE_CMD_SIZE + dataSize - 3);
     
     if (packet[dataSize + BASE_CMD_SIZE - 1] != CMD_STOP || readChecksum != computedChecksum)
         return CYBTLDR_STAT_ERR_UNK;
@@ -8,7 +8,7 @@
 #ifndef __CYBTLDR_COMMAND_H__
 #define __CYBTLDR_COMMAND_H__
 
-#include "cybtldr_utils.h"
+#include "cybtldr_session.h"
 
 /* Maximum number of bytes to allocate for a single command.  */
 #define MAX_COMMAND_SIZE 512
@@ -52,34 +52,23 @@
 /* Command identifier for exiting the bootloader and restarting the target program. */
 #define CMD_EXIT_BOOTLOADER     0x3B
 
-/*
- * This enum defines the different types of checksums that can be 
- * used by the bootloader for ensuring data integrety.
- */
-typedef enum
-{
-    /* Checksum type is a basic inverted summation of all bytes */
-    SUM_CHECKSUM = 0x00,
-    /* 16-bit CRC checksum using the CCITT implementation */
-    CRC_CHECKSUM = 0x01,
-} CyBtldr_ChecksumType;
-
 /*******************************************************************************
 * Function Name: CyBtldr_ComputeChecksum
 ********************************************************************************
 * Summary:
-*   Computes the 2byte checksum for the provided command data.  The checksum is 
-*   the 2's complement of the 1-byte sum of all bytes.
+*   Computes the 2byte checksum for the provided command data, with the
+*   checksum function selected for the session by CyBtldr_SetCheckSumType.
 *
 * Parameters:
-*   buf  - The data to compute the checksum on
-*   size - The number of bytes contained in buf.
+*   session - The session whose checksum type is used
+*   buf     - The data to compute the checksum on
+*   size    - The number of bytes contained in buf.
 *
 * Returns:
 *   The checksum for the provided data.
 *
 *******************************************************************************/
-unsigned short CyBtldr_ComputeChecksum(unsigned char* buf, unsigned long size);
+unsigned short CyBtldr_ComputeChecksum(CyBtldr_Session* session, unsigned char* buf, unsigned long size);
 
 /*******************************************************************************
 * Function Name: CyBtldr_SetCheckSumType
@@ -88,13 +77,14 @@ unsigned short CyBtldr_ComputeChecksum(unsigned char* buf, unsigned long size);
 *   Updates what checksum algorithm is used when generating packets
 *
 * Parameters:
+*   session    - The session to update
 *   chksumType - The type of checksum to use when creating packets
 *
 * Returns:
 *   NA
 *
 *******************************************************************************/
-void CyBtldr_SetCheckSumType(CyBtldr_ChecksumType chksumType);
+void CyBtldr_SetCheckSumType(CyBtldr_Session* session, CyBtldr_ChecksumType chksumType);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseDefaultCmdResult
@@ -125,6 +115,7 @@ int CyBtldr_ParseDefaultCmdResult(unsigned char* cmdBuf, unsigned long cmdSize,
 *       other command.
 *
 * Parameters:
+*   session         - The session the command is created for
 *   protect         - The flash protection settings.
 *   cmdBuf          - The preallocated buffer to store command data in.
 *   cmdSize         - The number of bytes in the command.
@@ -135,7 +126,7 @@ int CyBtldr_ParseDefaultCmdResult(unsigned char* cmdBuf, unsigned long cmdSize,
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateEnterBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize, const unsigned char* securityKeyBuff);
+EXTERN int CyBtldr_CreateEnterBootLoaderCmd(CyBtldr_Session* session, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize, const unsigned char* securityKeyBuff);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseEnterBootLoaderCmdResult
@@ -169,6 +160,7 @@ EXTERN int CyBtldr_ParseEnterBootLoaderCmdResult(unsigned char* cmdBuf, unsigned
 *   application.
 *
 * Parameters:
+*   session   - The session the command is created for
 *   cmdBuf    - The preallocated buffer to store command data in.
 *   cmdSize   - The number of bytes in the command.
 *   resSize   - The number of bytes expected in the bootloader's response packet.
@@ -177,7 +169,7 @@ EXTERN int CyBtldr_ParseEnterBootLoaderCmdResult(unsigned char* cmdBuf, unsigned
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateExitBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
+EXTERN int CyBtldr_CreateExitBootLoaderCmd(CyBtldr_Session* session, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_CreateProgramRowCmd
@@ -186,6 +178,7 @@ EXTERN int CyBtldr_CreateExitBootLoaderCmd(unsigned char* cmdBuf, unsigned long*
 *   Creates the command used to program a single flash row.
 *
 * Parameters:
+*   session - The session the command is created for
 *   arrayId - The array id to program.
 *   rowNum  - The row number to program.
 *   buf     - The buffer of data to program into the flash row.
@@ -198,7 +191,7 @@ EXTERN int CyBtldr_CreateExitBootLoaderCmd(unsigned char* cmdBuf, unsigned long*
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateProgramRowCmd(unsigned char arrayId, unsigned short rowNum, unsigned char* buf, unsigned short size, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
+EXTERN int CyBtldr_CreateProgramRowCmd(CyBtldr_Session* session, unsigned char arrayId, unsigned short rowNum, unsigned char* buf, unsigned short size, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseProgramRowCmdResult
@@ -228,6 +221,7 @@ EXTERN int CyBtldr_ParseProgramRowCmdResult(unsigned char* cmdBuf, unsigned long
 *   provided row data.
 *
 * Parameters:
+*   session - The session the command is created for
 *   arrayId - The array id to verify.
 *   rowNum  - The row number to verify.
 *   cmdBuf  - The preallocated buffer to store command data in.
@@ -238,7 +232,7 @@ EXTERN int CyBtldr_ParseProgramRowCmdResult(unsigned char* cmdBuf, unsigned long
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateVerifyRowCmd(unsigned char arrayId, unsigned short rowNum, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
+EXTERN int CyBtldr_CreateVerifyRowCmd(CyBtldr_Session* session, unsigned char arrayId, unsigned short rowNum, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseVerifyRowCmdResult
@@ -268,6 +262,7 @@ EXTERN int CyBtldr_ParseVerifyRowCmdResult(unsigned char* cmdBuf, unsigned long
 *   Creates the command used to erase a single flash row.
 *
 * Parameters:
+*   session - The session the command is created for
 *   arrayId - The array id to erase.
 *   rowNum  - The row number to erase.
 *   cmdBuf  - The preallocated buffer to store command data in.
@@ -278,7 +273,7 @@ EXTERN int CyBtldr_ParseVerifyRowCmdResult(unsigned char* cmdBuf, unsigned long
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateEraseRowCmd(unsigned char arrayId, unsigned short rowNum, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
+EXTERN int CyBtldr_CreateEraseRowCmd(CyBtldr_Session* session, unsigned char arrayId, unsigned short rowNum, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseEraseRowCmdResult
@@ -308,6 +303,7 @@ EXTERN int CyBtldr_ParseEraseRowCmdResult(unsigned char* cmdBuf, unsigned long c
 *   what is expected.
 *
 * Parameters:
+*   session - The session the command is created for
 *   cmdBuf  - The preallocated buffer to store command data in.
 *   cmdSize - The number of bytes in the command.
 *   resSize - The number of bytes expected in the bootloader's response packet.
@@ -316,7 +312,7 @@ EXTERN int CyBtldr_ParseEraseRowCmdResult(unsigned char* cmdBuf, unsigned long c
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateVerifyChecksumCmd(unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
+EXTERN int CyBtldr_CreateVerifyChecksumCmd(CyBtldr_Session* session, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseVerifyChecksumCmdResult
@@ -346,6 +342,7 @@ EXTERN int CyBtldr_ParseVerifyChecksumCmdResult(unsigned char* cmdBuf, unsigned
 *   Creates the command used to retreive the number of flash rows in the device.
 *
 * Parameters:
+*   session - The session the command is created for
 *   arrayId - The array ID to get the flash size of.
 *   cmdBuf  - The preallocated buffer to store command data in.
 *   cmdSize - The number of bytes in the command.
@@ -355,7 +352,7 @@ EXTERN int CyBtldr_ParseVerifyChecksumCmdResult(unsigned char* cmdBuf, unsigned
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateGetFlashSizeCmd(unsigned char arrayId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
+EXTERN int CyBtldr_CreateGetFlashSizeCmd(CyBtldr_Session* session, unsigned char arrayId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseGetFlashSizeCmdResult
@@ -386,6 +383,7 @@ EXTERN int CyBtldr_ParseGetFlashSizeCmdResult(unsigned char* cmdBuf, unsigned lo
 *   Creates the command used to send a block of data to the target.
 *
 * Parameters:
+*   session - The session the command is created for
 *   buf     - The buffer of data data to program into the flash row.
 *   size    - The number of bytes in data for the row.
 *   cmdBuf  - The preallocated buffer to store command data in.
@@ -396,7 +394,7 @@ EXTERN int CyBtldr_ParseGetFlashSizeCmdResult(unsigned char* cmdBuf, unsigned lo
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateSendDataCmd(unsigned char* buf, unsigned short size, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
+EXTERN int CyBtldr_CreateSendDataCmd(CyBtldr_Session* session, unsigned char* buf, unsigned short size, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseSendDataCmdResult
@@ -426,6 +424,7 @@ EXTERN int CyBtldr_ParseSendDataCmdResult(unsigned char* cmdBuf, unsigned long c
 *   with the bootloader application.
 *
 * Parameters:
+*   session - The session the command is created for
 *   cmdBuf  - The preallocated buffer to store command data in.
 *   cmdSize - The number of bytes in the command.
 *   resSize - The number of bytes expected in the bootloader's response packet.
@@ -434,7 +433,7 @@ EXTERN int CyBtldr_ParseSendDataCmdResult(unsigned char* cmdBuf, unsigned long c
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateSyncBootLoaderCmd(unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
+EXTERN int CyBtldr_CreateSyncBootLoaderCmd(CyBtldr_Session* session, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_CreateGetAppStatusCmd
@@ -444,6 +443,7 @@ EXTERN int CyBtldr_CreateSyncBootLoaderCmd(unsigned char* cmdBuf, unsigned long*
 *   command is only supported by the multi application bootloaader.
 *
 * Parameters:
+*   session - The session the command is created for
 *   appId   - The id for the application to get status for
 *   cmdBuf  - The preallocated buffer to store command data in.
 *   cmdSize - The number of bytes in the command.
@@ -453,7 +453,7 @@ EXTERN int CyBtldr_CreateSyncBootLoaderCmd(unsigned char* cmdBuf, unsigned long*
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateGetAppStatusCmd(unsigned char appId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
+EXTERN int CyBtldr_CreateGetAppStatusCmd(CyBtldr_Session* session, unsigned char appId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseGetAppStatusCmdResult
@@ -486,6 +486,7 @@ EXTERN int CyBtldr_ParseGetAppStatusCmdResult(unsigned char* cmdBuf, unsigned lo
 *   bootloaader.
 *
 * Parameters:
+*   session - The session the command is created for
 *   appId   - The id for the application to get status for
 *   cmdBuf  - The preallocated buffer to store command data in.
 *   cmdSize - The number of bytes in the command.
@@ -495,7 +496,7 @@ EXTERN int CyBtldr_ParseGetAppStatusCmdResult(unsigned char* cmdBuf, unsigned lo
 *   CYRET_SUCCESS  - The command was constructed successfully
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CreateSetActiveAppCmd(unsigned char appId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
+EXTERN int CyBtldr_CreateSetActiveAppCmd(CyBtldr_Session* session, unsigned char appId, unsigned char* cmdBuf, unsigned long* cmdSize, unsigned long* resSize);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseSetActiveAppCmdResult
@@ -517,6 +518,22 @@ EXTERN int CyBtldr_CreateSetActiveAppCmd(unsigned char appId, unsigned char* cmd
 *******************************************************************************/
 EXTERN int CyBtldr_ParseSetActiveAppCmdResult(unsigned char* cmdBuf, unsigned long cmdSize, unsigned char* status);
 
+/*******************************************************************************
+* Function Name: CyBtldr_GetCommandName
+********************************************************************************
+* Summary:
+*   Returns a printable name for a command identifier, to report and trace
+*   the commands sent.
+*
+* Parameters:
+*   cmd - The command identifier (CMD_*)
+*
+* Returns:
+*   The name of the command, or "unknown".
+*
+*******************************************************************************/
+EXTERN const char* CyBtldr_GetCommandName(unsigned char cmd);
+
 /*******************************************************************************
 * Function Name: CyBtldr_TryParseParketStatus
 ********************************************************************************
@@ -524,6 +541,7 @@ EXTERN int CyBtldr_ParseSetActiveAppCmdResult(unsigned char* cmdBuf, unsigned lo
 *   Parses the output packet data
 *
 * Parameters:
+*   session     - The session whose checksum type is used
 *   packet      - The preallocated buffer to store command data in.
 *   packetSize  - The number of bytes in the command.
 *   status      - The status code returned by the bootloader.
@@ -533,5 +551,5 @@ EXTERN int CyBtldr_ParseSetActiveAppCmdResult(unsigned char* cmdBuf, unsigned lo
 *   CYBTLDR_STAT_ERR_UNK    - The packet is not a valid packet
 *
 *******************************************************************************/
-int CyBtldr_TryParseParketStatus(unsigned char* packet, int packetSize, unsigned char* status);
+int CyBtldr_TryParseParketStatus(CyBtldr_Session* session, unsigned char* packet, int packetSize, unsigned char* status);
 #endif
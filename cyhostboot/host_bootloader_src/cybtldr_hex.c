@@ -0,0 +1,101 @@
+#include "cybtldr_hex.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CYBTLDR_HEX_X86
+#include <immintrin.h>
+#endif
+
+/* Nibble value of each character plus one, 0 for characters which are
+ * not hex digits */
+static const unsigned char hexValues[256] =
+{
+    ['0'] = 0x01, ['1'] = 0x02, ['2'] = 0x03, ['3'] = 0x04, ['4'] = 0x05,
+    ['5'] = 0x06, ['6'] = 0x07, ['7'] = 0x08, ['8'] = 0x09, ['9'] = 0x0A,
+    ['A'] = 0x0B, ['B'] = 0x0C, ['C'] = 0x0D, ['D'] = 0x0E, ['E'] = 0x0F, ['F'] = 0x10,
+    ['a'] = 0x0B, ['b'] = 0x0C, ['c'] = 0x0D, ['d'] = 0x0E, ['e'] = 0x0F, ['f'] = 0x10,
+};
+
+int CyBtldr_HexDecodeScalar(const char* hex, unsigned long size, unsigned char* data)
+{
+    unsigned char hi;
+    unsigned char lo;
+
+    while (size-- > 0)
+    {
+        hi = hexValues[(unsigned char)*hex++];
+        lo = hexValues[(unsigned char)*hex++];
+        if (0 == hi || 0 == lo)
+            return CYRET_ERR_DATA;
+        *data++ = (unsigned char)(((hi - 1) << 4) | (lo - 1));
+    }
+
+    return CYRET_SUCCESS;
+}
+
+#ifdef CYBTLDR_HEX_X86
+
+/* Decodes 16 hex digits to 8 bytes:
+ * - digits and letters (either case) are checked with range compares
+ * - each 16-bit lane holds two nibbles, merged as (first << 4) | second
+ * - lanes are packed down to bytes */
+__attribute__((target("sse2")))
+static int CyBtldr_HexDecodeSse2(const char* hex, unsigned long size, unsigned char* data)
+{
+    __m128i c, lower, digit, alpha, value;
+
+    for (; size >= 8; size -= 8, hex += 16, data += 8)
+    {
+        c = _mm_loadu_si128((const __m128i*)hex);
+        lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+        digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+        alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+        if (0xFFFF != _mm_movemask_epi8(_mm_or_si128(digit, alpha)))
+            return CYRET_ERR_DATA;
+
+        value = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+            _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+        value = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(value, _mm_set1_epi16(0x00FF)), 4), _mm_srli_epi16(value, 8));
+        _mm_storel_epi64((__m128i*)data, _mm_packus_epi16(value, value));
+    }
+
+    return CyBtldr_HexDecodeScalar(hex, size, data);
+}
+
+/* Same as CyBtldr_HexDecodeSse2 with 32 hex digits at a time */
+__attribute__((target("avx2")))
+static int CyBtldr_HexDecodeAvx2(const char* hex, unsigned long size, unsigned char* data)
+{
+    __m256i c, lower, digit, alpha, value;
+
+    for (; size >= 16; size -= 16, hex += 32, data += 16)
+    {
+        c = _mm256_loadu_si256((const __m256i*)hex);
+        lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+        digit = _mm256_andnot_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('9')), _mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)));
+        alpha = _mm256_andnot_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('f')), _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)));
+        if (-1 != _mm256_movemask_epi8(_mm256_or_si256(digit, alpha)))
+            return CYRET_ERR_DATA;
+
+        value = _mm256_or_si256(_mm256_and_si256(digit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+            _mm256_and_si256(alpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+        value = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(value, _mm256_set1_epi16(0x00FF)), 4), _mm256_srli_epi16(value, 8));
+        /* Packing works within 128-bit lanes, gather both results in the low lane */
+        value = _mm256_permute4x64_epi64(_mm256_packus_epi16(value, value), 0x08);
+        _mm_storeu_si128((__m128i*)data, _mm256_castsi256_si128(value));
+    }
+
+    return CyBtldr_HexDecodeSse2(hex, size, data);
+}
+
+#endif
+
+int CyBtldr_HexDecode(const char* hex, unsigned long size, unsigned char* data)
+{
+#ifdef CYBTLDR_HEX_X86
+    if (__builtin_cpu_supports("avx2"))
+        return CyBtldr_HexDecodeAvx2(hex, size, data);
+    if (__builtin_cpu_supports("sse2"))
+        return CyBtldr_HexDecodeSse2(hex, size, data);
+#endif
+    return CyBtldr_HexDecodeScalar(hex, size, data);
+}
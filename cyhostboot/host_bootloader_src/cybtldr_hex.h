@@ -0,0 +1,47 @@
+#ifndef __CYBTLDR_HEX_H__
+#define __CYBTLDR_HEX_H__
+
+#include "cybtldr_utils.h"
+
+/* Function decoding hex digits to bytes */
+typedef int CyBtldr_HexDecodeFunc(const char* hex, unsigned long size, unsigned char* data);
+
+/*******************************************************************************
+* Function Name: CyBtldr_HexDecode
+********************************************************************************
+* Summary:
+*   Decodes a string of hex digits to bytes, two digits per byte, checking
+*   that all characters are valid hex digits.  Uses AVX2 or SSE2 when
+*   available, else CyBtldr_HexDecodeScalar.
+*
+* Parameters:
+*   hex  - The hex digits to decode, not null terminated
+*   size - The number of bytes to decode (hex holds twice as many digits)
+*   data - The preallocated buffer to store size decoded bytes
+*
+* Returns:
+*   CYRET_SUCCESS  - The digits were decoded successfully
+*   CYRET_ERR_DATA - hex contains a character which is not a hex digit
+*
+*******************************************************************************/
+EXTERN int CyBtldr_HexDecode(const char* hex, unsigned long size, unsigned char* data);
+
+/*******************************************************************************
+* Function Name: CyBtldr_HexDecodeScalar
+********************************************************************************
+* Summary:
+*   Same as CyBtldr_HexDecode, one byte at a time with a lookup table.
+*
+* Parameters:
+*   hex  - The hex digits to decode, not null terminated
+*   size - The number of bytes to decode (hex holds twice as many digits)
+*   data - The preallocated buffer to store size decoded bytes
+*
+* Returns:
+*   CYRET_SUCCESS  - The digits were decoded successfully
+*   CYRET_ERR_DATA - hex contains a character which is not a hex digit
+*
+*******************************************************************************/
+EXTERN int CyBtldr_HexDecodeScalar(const char* hex, unsigned long size, unsigned char* data);
+
+#endif
@@ -5,11 +5,16 @@
 * the software package with which this file was provided.
 ********************************************************************************/
 
+#include <stdlib.h>
 #include <string.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "cybtldr_parse.h"
-
-/* Pointer to the *.cyacd file containing the data that is to be read */
-static FILE* dataFile;
+#include "cybtldr_hex.h"
 
 unsigned char CyBtldr_FromHex(char value)
 {
@@ -41,14 +46,14 @@ int CyBtldr_FromAscii(unsigned int bufSize, unsigned char* buffer, unsigned shor
     return err;
 }
 
-int CyBtldr_ReadLine(unsigned int* size, char* buffer)
+int CyBtldr_ReadLine(CyBtldr_Session* session, unsigned int* size, char* buffer)
 {
     int err = CYRET_SUCCESS;
     unsigned int len = 0;
 
-    if (NULL != dataFile && !feof(dataFile))
+    if (NULL != session->dataFile && !feof(session->dataFile))
     {
-        if (NULL != fgets(buffer, MAX_BUFFER_SIZE, dataFile))
+        if (NULL != fgets(buffer, MAX_BUFFER_SIZE, session->dataFile))
         {
             len = strlen(buffer);
 
@@ -65,11 +70,11 @@ int CyBtldr_ReadLine(unsigned int* size, char* buffer)
     return err;
 }
 
-int CyBtldr_OpenDataFile(const char* file)
+int CyBtldr_OpenDataFile(CyBtldr_Session* session, const char* file)
 {
-    dataFile = fopen(file, "r");
+    session->dataFile = fopen(file, "r");
 
-    return (NULL == dataFile)
+    return (NULL == session->dataFile)
         ? CYRET_ERR_FILE
         : CYRET_SUCCESS;
 }
@@ -137,15 +142,214 @@ int CyBtldr_ParseRowData(unsigned int bufSize, unsigned char* buffer, unsigned c
     return err;
 }
 
-int CyBtldr_CloseDataFile(void)
+int CyBtldr_CloseDataFile(CyBtldr_Session* session)
 {
     int err = 0;
-    if (NULL != dataFile)
+    if (NULL != session->dataFile)
     {
-        err = fclose(dataFile);
-        dataFile = NULL;
+        err = fclose(session->dataFile);
+        session->dataFile = NULL;
     }
     return (0 == err)
         ? CYRET_SUCCESS
         : CYRET_ERR_FILE;
 }
+
+/* Maps the whole file in memory, or reads it if it cannot be mapped */
+static int CyBtldr_MapFile(const char* file, char** text, unsigned long* size, unsigned char* mapped)
+{
+    FILE* dataFile;
+    size_t len;
+    void* tmp;
+    int err = CYRET_SUCCESS;
+#ifndef WIN32
+    struct stat st;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return CYRET_ERR_FILE;
+    *mapped = 0;
+    if (0 == fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED != *text)
+        {
+            *size = st.st_size;
+            *mapped = 1;
+        }
+    }
+    close(fd);
+    if (*mapped)
+        return CYRET_SUCCESS;
+#endif
+
+    dataFile = fopen(file, "rb");
+    if (NULL == dataFile)
+        return CYRET_ERR_FILE;
+    *text = NULL;
+    *size = 0;
+    do
+    {
+        tmp = realloc(*text, *size + 64 * 1024);
+        if (NULL == tmp)
+        {
+            err = CYRET_ERR_FILE;
+            break;
+        }
+        *text = (char*)tmp;
+        len = fread(*text + *size, 1, 64 * 1024, dataFile);
+        *size += len;
+    }
+    while (len > 0);
+    if (ferror(dataFile))
+        err = CYRET_ERR_FILE;
+    fclose(dataFile);
+
+    return err;
+}
+
+static void CyBtldr_UnmapFile(char* text, unsigned long size, unsigned char mapped)
+{
+#ifndef WIN32
+    if (mapped)
+    {
+        munmap(text, size);
+        return;
+    }
+#endif
+    free(text);
+}
+
+static int CyBtldr_LoadHeader(const char* line, unsigned long lineLen, CyBtldr_Image* image)
+{
+    const unsigned long LENGTH_ID     = 5;             //4-silicon id, 1-silicon rev
+    const unsigned long LENGTH_CHKSUM = LENGTH_ID + 1; //1-checksum type
+
+    unsigned char header[MAX_BUFFER_SIZE / 2];
+    unsigned long size = lineLen / 2;
+    int err = CYRET_SUCCESS;
+
+    if ((lineLen & 1) || size < LENGTH_ID || size > sizeof(header))
+        err = CYRET_ERR_LENGTH;
+    if (CYRET_SUCCESS == err)
+        err = CyBtldr_HexDecode(line, size, header);
+    if (CYRET_SUCCESS == err)
+    {
+        image->siliconId = (header[0] << 24) | (header[1] << 16) | (header[2] << 8) | (header[3]);
+        image->siliconRev = header[4];
+        image->checksumType = (size >= LENGTH_CHKSUM) ? (CyBtldr_ChecksumType)header[5] : SUM_CHECKSUM;
+        if (SUM_CHECKSUM != image->checksumType && CRC_CHECKSUM != image->checksumType)
+            err = CYRET_ERR_DATA;
+    }
+
+    return err;
+}
+
+/* Decodes a row straight into its final storage */
+static int CyBtldr_LoadRow(const char* line, unsigned long lineLen, CyBtldr_Row* row, unsigned char* rowData)
+{
+    const unsigned long MIN_SIZE = 6; //1-array, 2-addr, 2-size, 1-checksum
+    const unsigned long DATA_OFFSET = 1 + 2 * 5;
+
+    unsigned char header[5];
+    unsigned char sum;
+    int err = CYRET_SUCCESS;
+
+    if (lineLen < 1 + 2 * MIN_SIZE)
+        err = CYRET_ERR_LENGTH;
+    else if (':' != line[0])
+        err = CYRET_ERR_CMD;
+    if (CYRET_SUCCESS == err)
+        err = CyBtldr_HexDecode(&line[1], sizeof(header), header);
+    if (CYRET_SUCCESS == err)
+    {
+        row->arrayId = header[0];
+        row->rowNum = (header[1] << 8) | (header[2]);
+        row->size = (header[3] << 8) | (header[4]);
+        row->data = rowData;
+        if (lineLen != 1 + 2 * (MIN_SIZE + row->size))
+            err = CYRET_ERR_DATA;
+    }
+    if (CYRET_SUCCESS == err)
+        err = CyBtldr_HexDecode(&line[DATA_OFFSET], row->size, rowData);
+    if (CYRET_SUCCESS == err)
+        err = CyBtldr_HexDecode(&line[DATA_OFFSET + 2 * row->size], 1, &row->checksum);
+    if (CYRET_SUCCESS == err)
+    {
+        /* The row checksum is the 2's complement of the sum of all other bytes */
+        sum = (unsigned char)(header[0] + header[1] + header[2] + header[3] + header[4] + row->checksum);
+        sum -= (unsigned char)CyBtldr_SumChecksum(rowData, row->size);
+        if (0 != sum)
+            err = CYRET_ERR_CHECKSUM;
+    }
+
+    return err;
+}
+
+int CyBtldr_LoadImage(const char* file, CyBtldr_Image* image)
+{
+    char* text;
+    const char* line;
+    const char* end;
+    const char* next;
+    unsigned long size;
+    unsigned long lineLen;
+    unsigned long lineCount = 1;
+    unsigned long dataLen = 0;
+    unsigned char mapped;
+    int err;
+
+    memset(image, 0, sizeof(*image));
+    err = CyBtldr_MapFile(file, &text, &size, &mapped);
+    if (CYRET_SUCCESS != err)
+        return err;
+
+    /* Rows are at least twice as big as their data, size storage from the file */
+    end = text + size;
+    for (line = text; NULL != (line = memchr(line, '\n', end - line)); line++)
+        lineCount++;
+    image->rows = (CyBtldr_Row*)malloc(lineCount * sizeof(CyBtldr_Row));
+    image->data = (unsigned char*)malloc(size / 2 + 1);
+    if (NULL == image->rows || NULL == image->data)
+        err = CYRET_ERR_FILE;
+
+    for (line = text; CYRET_SUCCESS == err && line < end; line = next)
+    {
+        next = memchr(line, '\n', end - line);
+        next = (NULL == next) ? end : next + 1;
+        lineLen = next - line;
+        while (lineLen > 0 && ('\n' == line[lineLen - 1] || '\r' == line[lineLen - 1]))
+            --lineLen;
+
+        image->errLine++;
+        if (1 == image->errLine)
+            err = CyBtldr_LoadHeader(line, lineLen, image);
+        else if (lineLen > 0)
+        {
+            err = CyBtldr_LoadRow(line, lineLen, &image->rows[image->rowCount], &image->data[dataLen]);
+            if (CYRET_SUCCESS == err)
+                dataLen += image->rows[image->rowCount++].size;
+        }
+    }
+
+    if (CYRET_SUCCESS == err && 0 == image->errLine)
+        err = CYRET_ERR_FILE;
+    CyBtldr_UnmapFile(text, size, mapped);
+
+    if (CYRET_SUCCESS == err)
+        image->errLine = 0;
+    else
+        CyBtldr_FreeImage(image);
+
+    return err;
+}
+
+void CyBtldr_FreeImage(CyBtldr_Image* image)
+{
+    free(image->rows);
+    free(image->data);
+    image->rows = NULL;
+    image->data = NULL;
+    image->rowCount = 0;
+}
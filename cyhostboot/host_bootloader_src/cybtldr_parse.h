@@ -8,12 +8,51 @@
 #ifndef __CYBTLDR_PARSE_H__
 #define __CYBTLDR_PARSE_H__
 
-#include "cybtldr_utils.h"
+#include "cybtldr_session.h"
 
 /* Maximum number of bytes to allocate for a single row.  */
 /* NB: Rows should have a max of 592 chars (2-arrayID, 4-rowNum, 4-len, 576-data, 2-checksum, 4-newline) */
 #define MAX_BUFFER_SIZE 768
 
+/*
+ * This struct holds a single row of data from a *.cyacd file.
+ */
+typedef struct
+{
+    /* The flash array that the row of data belongs in */
+    unsigned char arrayId;
+    /* The flash row number that the data corresponds to */
+    unsigned short rowNum;
+    /* The number of bytes of data */
+    unsigned short size;
+    /* The checksum value for the entire row (rowNum, size, data) */
+    unsigned char checksum;
+    /* The flash row data */
+    unsigned char* data;
+} CyBtldr_Row;
+
+/*
+ * This struct holds the whole content of a *.cyacd file, read and
+ * validated by CyBtldr_LoadImage.
+ */
+typedef struct
+{
+    /* The silicon id of the device the file is built for */
+    unsigned long siliconId;
+    /* The silicon revision of the device the file is built for */
+    unsigned char siliconRev;
+    /* The type of checksum used for packets */
+    CyBtldr_ChecksumType checksumType;
+    /* The number of rows of the file */
+    unsigned int rowCount;
+    /* The rows of the file, in file order */
+    CyBtldr_Row* rows;
+    /* Storage for the data of all rows */
+    unsigned char* data;
+    /* The line of the file that failed to load */
+    unsigned int errLine;
+} CyBtldr_Image;
+
 /*******************************************************************************
 * Function Name: CyBtldr_FromHex
 ********************************************************************************
@@ -57,6 +96,7 @@ int CyBtldr_FromAscii(unsigned int bufSize, unsigned char* buffer, unsigned shor
 *   any Windows, Linux, or Unix line endings from the data.
 *
 * Parameters:
+*   session - The session the file is read for
 *   size - The number of bytes of data read from the line and stored in buffer
 *   file - The preallocated buffer, with MAX_BUFFER_SIZE bytes, to store the 
 *          read data in.
@@ -67,7 +107,7 @@ int CyBtldr_FromAscii(unsigned int bufSize, unsigned char* buffer, unsigned shor
 *   CYRET_ERR_EOF  - The end of the file has been reached
 *
 *******************************************************************************/
-EXTERN int CyBtldr_ReadLine(unsigned int* size, char* buffer);
+EXTERN int CyBtldr_ReadLine(CyBtldr_Session* session, unsigned int* size, char* buffer);
 
 /*******************************************************************************
 * Function Name: CyBtldr_OpenDataFile
@@ -80,6 +120,7 @@ EXTERN int CyBtldr_ReadLine(unsigned int* size, char* buffer);
 *   the file, a call to CloseDataFile() should be made to release resources.
 *
 * Parameters:
+*   session - The session the file is read for
 *   file - The full canonical path to the *.cyacd file to open
 *
 * Returns:
@@ -87,7 +128,7 @@ EXTERN int CyBtldr_ReadLine(unsigned int* size, char* buffer);
 *   CYRET_ERR_FILE - An error occurred opening the provided file.
 *
 *******************************************************************************/
-EXTERN int CyBtldr_OpenDataFile(const char* file);
+EXTERN int CyBtldr_OpenDataFile(CyBtldr_Session* session, const char* file);
 
 /*******************************************************************************
 * Function Name: CyBtldr_ParseHeader
@@ -144,13 +185,53 @@ EXTERN int CyBtldr_ParseRowData(unsigned int bufSize, unsigned char* buffer, uns
 *   Closes the data file pointer.
 *
 * Parameters:
-*   void.
+*   session - The session the file is read for
 *
 * Returns:
 *   CYRET_SUCCESS  - The file was opened successfully.
 *   CYRET_ERR_FILE - An error occured opening the provided file.
 *
 *******************************************************************************/
-EXTERN int CyBtldr_CloseDataFile(void);
+EXTERN int CyBtldr_CloseDataFile(CyBtldr_Session* session);
+
+/*******************************************************************************
+* Function Name: CyBtldr_LoadImage
+********************************************************************************
+* Summary:
+*   Reads the whole *.cyacd file into memory, checking the header and the
+*   length, hex digits and checksum of every row.  This allows to detect a
+*   corrupted file before anything is sent to the device.  The file is mapped
+*   in memory when possible and rows are decoded straight into the image.
+*   The image must be released with CyBtldr_FreeImage once successfully loaded.
+*
+* Parameters:
+*   file  - The full canonical path to the *.cyacd file to open
+*   image - The image to fill, errLine is set if the file is invalid
+*
+* Returns:
+*   CYRET_SUCCESS      - The file was loaded successfully.
+*   CYRET_ERR_FILE     - An error occured opening or reading the provided file.
+*   CYRET_ERR_LENGTH   - A line does not contain enough data
+*   CYRET_ERR_DATA     - A line does not contain valid hex data or a full row
+*   CYRET_ERR_CMD      - A row does not start with the cmd identifier ':'
+*   CYRET_ERR_CHECKSUM - A row checksum does not match its data
+*
+*******************************************************************************/
+EXTERN int CyBtldr_LoadImage(const char* file, CyBtldr_Image* image);
+
+/*******************************************************************************
+* Function Name: CyBtldr_FreeImage
+********************************************************************************
+* Summary:
+*   Releases the memory used by an image loaded by CyBtldr_LoadImage.
+*
+* Parameters:
+*   image - The image to release
+*
+* Returns:
+*   NA
+*
+*******************************************************************************/
+EXTERN void CyBtldr_FreeImage(CyBtldr_Image* image);
 
 #endif
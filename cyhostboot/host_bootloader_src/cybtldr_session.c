@@ -0,0 +1,10 @@
+#include <string.h>
+#include "cybtldr_session.h"
+
+void CyBtldr_InitSession(CyBtldr_Session* session, CyBtldr_CommunicationsData* comm)
+{
+    memset(session, 0, sizeof(*session));
+    session->comm = comm;
+    session->checksumType = SUM_CHECKSUM;
+    session->checksumFunc = CyBtldr_GetChecksumFunc(SUM_CHECKSUM);
+}
@@ -0,0 +1,138 @@
+#ifndef __CYBTLDR_SESSION_H__
+#define __CYBTLDR_SESSION_H__
+
+#include "cybtldr_utils.h"
+#include "cybtldr_checksum.h"
+
+/* The maximum number of flash arrays */
+#define MAX_FLASH_ARRAYS 0x40
+
+/* Program all rows without verifying each of them, the whole application is
+ * verified at the end instead (requires bootloader v2.20 or later) */
+#define CYBTLDR_FLAG_FAST_PROGRAM 0x01
+/* Only program the rows whose checksum on the device differs from the file */
+#define CYBTLDR_FLAG_DELTA_PROGRAM 0x02
+/* Do not program anything if the device already holds the file */
+#define CYBTLDR_FLAG_SKIP_UP_TO_DATE 0x04
+
+/* The delay before a retry stops doubling after this many retries, and never
+ * exceeds this many milliseconds */
+#define CYBTLDR_MAX_RETRY_SHIFT 10
+#define CYBTLDR_MAX_RETRY_DELAY 5000
+
+/*
+ * This struct defines all of the items necessary for the bootloader
+ * host to communicate over an arbitrary communication protocol. The
+ * caller must provide implementations of these items to use their
+ * deisred communication protocol.
+ */
+typedef struct
+{
+    /* Function used to open the communications connection */
+    int (*OpenConnection)(void*);
+    /* Function used to close the communications connection */
+    int (*CloseConnection)(void*);
+    /* Function used to read data over the communications connection */
+    int (*ReadData)(void*, unsigned char*, int);
+    /* Function used to write data over the communications connection */
+    int (*WriteData)(void*, unsigned char*, int);
+    /* Optional function used to wait before a retry, in milliseconds (NULL to sleep) */
+    void (*Delay)(void*, unsigned int);
+    /* Value used to specify the maximum number of bytes that can be trasfered at a time,
+     * 0 to probe it when programming (see CyBtldr_ProbeTransferSize) */
+    unsigned int MaxTransferSize;
+    /* User pointer passed as first argument to all of the above functions */
+    void* Context;
+} CyBtldr_CommunicationsData;
+
+/*
+ * This struct holds the progress of the operation running on a session,
+ * it is up to date when the progress callback is called.
+ */
+typedef struct
+{
+    /* Number of rows of the file processed so far */
+    unsigned int rowsDone;
+    /* Total number of rows of the file */
+    unsigned int rowCount;
+    /* Number of bytes of row data processed so far */
+    unsigned long bytesDone;
+    /* Total number of bytes of row data of the file */
+    unsigned long byteCount;
+} CyBtldr_Progress;
+
+/*
+ * This struct holds the state of a bootload session with a single device.
+ * Each device being bootloaded must have its own session, which allows
+ * several devices to be driven from the same process.
+ */
+typedef struct
+{
+    /* Communication struct used for communicating with the target device */
+    CyBtldr_CommunicationsData* comm;
+    /* The type of checksum used for packets */
+    CyBtldr_ChecksumType checksumType;
+    /* The function computing the checksum of packets, selected from checksumType */
+    CyBtldr_ChecksumFunc* checksumFunc;
+    /* Cache of the valid row range for each flash array (minRow << 16 | maxRow) */
+    unsigned long validRows[MAX_FLASH_ARRAYS];
+    /* Pointer to the *.cyacd file containing the data that is to be read */
+    FILE* dataFile;
+    /* Set to abort the operation running on this session */
+    volatile unsigned char abort;
+    /* Options for the operations run on this session (CYBTLDR_FLAG_*) */
+    unsigned int flags;
+    /* Index in the image of the row to resume programming from, the rows
+     * before it having been programmed by an interrupted operation (0 to
+     * program all rows) */
+    unsigned int resumeRow;
+    /* Set when the last operation failed on a specific row */
+    unsigned char errRowValid;
+    /* Index in the image of the row the last operation failed on */
+    unsigned int errRowIdx;
+    /* The array of the row the last operation failed on */
+    unsigned char errArrayId;
+    /* The row number the last operation failed on */
+    unsigned short errRowNum;
+    /* Number of rows left untouched by the last delta program operation */
+    unsigned int skippedRows;
+    /* Index of the row the last program operation resumed from */
+    unsigned int resumedRow;
+    /* Set when the last program operation found the device up to date */
+    unsigned char upToDate;
+    /* Set when the probe of the transfer size of the last program operation
+     * found no size accepted and fell back to 64 byte packets */
+    unsigned char transferSizeFallback;
+    /* Progress of the running operation */
+    CyBtldr_Progress progress;
+    /* Number of times a packet that failed on the line is sent again, after
+     * resynchronizing with the bootloader (0 to fail at once) */
+    unsigned int retryCount;
+    /* Delay before the first retry in milliseconds, doubled at each retry
+     * (see CYBTLDR_MAX_RETRY_SHIFT and CYBTLDR_MAX_RETRY_DELAY) */
+    unsigned int retryDelay;
+    /* Number of retries done by the last operation */
+    unsigned int retries;
+    /* Index of the step of CyBtldr_RunSteps the last operation failed on, or
+     * of its last step if it succeeded */
+    unsigned int step;
+} CyBtldr_Session;
+
+/*******************************************************************************
+* Function Name: CyBtldr_InitSession
+********************************************************************************
+* Summary:
+*   Initializes a session before its first use.  This must be called before
+*   passing the session to any other function.
+*
+* Parameters:
+*   session - The session to initialize
+*   comm    - Communication struct used for communicating with the target device
+*
+* Returns:
+*   NA
+*
+*******************************************************************************/
+EXTERN void CyBtldr_InitSession(CyBtldr_Session* session, CyBtldr_CommunicationsData* comm);
+
+#endif
@@ -55,8 +55,12 @@
 #define CYRET_ERR_BTLDR         0x0B
 /* The application is currently marked as active */
 #define CYRET_ERR_ACTIVE        0x0C
+/* An argument passed to the function is not valid */
+#define CYRET_ERR_ARG           0x0D
 /* An unknown error occured */
 #define CYRET_ERR_UNK           0x0F
+/* The operation can not complete without blocking, it must be done again */
+#define CYRET_AGAIN             0xFE
 /* The operation was aborted */
 #define CYRET_ABORT             0xFF
 
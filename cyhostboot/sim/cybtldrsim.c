@@ -0,0 +1,741 @@
+/*
+ * Cypress UART bootloader simulator.
+ *
+ * Opens a pseudo terminal and answers the bootloader commands sent to its
+ * slave side, programming an in-memory flash.  cyhostboot can then be run
+ * against the slave as against a real board:
+ *
+ *	cybtldrsim -l /tmp/cybtldr &
+ *	cyhostboot -s /tmp/cybtldr -f app.cyacd
+ *
+ * or listens on a TCP port instead, as a serial server (ser2net, socat) in
+ * raw mode would, for one host at a time:
+ *
+ *	cybtldrsim -t 2000 &
+ *	cyhostboot -s tcp://localhost:2000 -f app.cyacd
+ *
+ * or emulates a USB HID bootloader through /dev/uhid:
+ *
+ *	cybtldrsim -u 04b4:b71d &
+ *	cyhostboot -s hid:04b4:b71d -f app.cyacd
+ */
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <linux/uhid.h>
+
+#include <cybtldr_checksum.h>
+#include <cybtldr_command.h>
+
+#include "cybtldrsim_cmdline.h"
+
+#define KEY_BYTES		6
+#define APP_COUNT		2
+/* Biggest packet that can be framed, whatever the buffer size of the device */
+#define RX_BUF_SIZE		(0x10000 + BASE_CMD_SIZE)
+/* Size of the input and output reports of the HID bootloader */
+#define HID_REPORT_SIZE		64
+
+struct sim_device {
+	unsigned long silicon_id;
+	unsigned char silicon_rev;
+	unsigned long bl_version;
+	unsigned int arrays;
+	unsigned int first_row;
+	unsigned int last_row;
+	unsigned int row_size;
+	unsigned int buffer_size;
+	unsigned int write_latency;
+	unsigned int baudrate;
+	unsigned int drop;
+	unsigned long responses;
+	/* Set when the device is a HID one, its packets sent in reports */
+	int uhid;
+	int multi_app;
+	int has_key;
+	unsigned char key[KEY_BYTES];
+	CyBtldr_ChecksumFunc *checksum;
+
+	/* Flash content and per row state, indexed by array * rows + row */
+	unsigned char *flash;
+	unsigned char *programmed;
+	unsigned char *corrupt;
+
+	int entered;
+	unsigned char active_app;
+	/* Data received through SEND_DATA for the next PROGRAM_ROW */
+	unsigned char *row_buf;
+	unsigned int row_buf_len;
+
+	unsigned long stats[256];
+};
+
+static volatile sig_atomic_t g_stop;
+static int g_verbose;
+
+static void sim_stop(int sig)
+{
+	g_stop = 1;
+}
+
+static void sim_sleep_us(unsigned long us)
+{
+	struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR && !g_stop)
+		;
+}
+
+static void sim_print_stats(struct sim_device *dev)
+{
+	int i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		if (!dev->stats[i])
+			continue;
+		fprintf(stderr, "%s %s=%lu", count++ ? "" : "cybtldrsim: commands", CyBtldr_GetCommandName(i), dev->stats[i]);
+	}
+	if (count)
+		fprintf(stderr, "\n");
+	memset(dev->stats, 0, sizeof(dev->stats));
+}
+
+static int sim_write(int fd, const unsigned char *buf, unsigned long size)
+{
+	ssize_t ret;
+
+	while (size) {
+		ret = write(fd, buf, size);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+/* Vendor defined usage with 64 byte input and output reports, not numbered */
+static const unsigned char hid_report_desc[] = {
+	0x06, 0x00, 0xff,	/* Usage Page (Vendor Defined) */
+	0x09, 0x01,		/* Usage (1) */
+	0xa1, 0x01,		/* Collection (Application) */
+	0x15, 0x00,		/*   Logical Minimum (0) */
+	0x26, 0xff, 0x00,	/*   Logical Maximum (255) */
+	0x75, 0x08,		/*   Report Size (8) */
+	0x95, HID_REPORT_SIZE,	/*   Report Count (64) */
+	0x09, 0x01,		/*   Usage (1) */
+	0x81, 0x02,		/*   Input (Data, Variable, Absolute) */
+	0x95, HID_REPORT_SIZE,	/*   Report Count (64) */
+	0x09, 0x01,		/*   Usage (1) */
+	0x91, 0x02,		/*   Output (Data, Variable, Absolute) */
+	0xc0,			/* End Collection */
+};
+
+static int sim_uhid_send(int fd, struct uhid_event *ev)
+{
+	return sim_write(fd, (const unsigned char *)ev, sizeof(*ev));
+}
+
+/* Create the HID device from VID:PID[:serial] */
+static int sim_uhid_create(int fd, const char *ids)
+{
+	struct uhid_event ev;
+	unsigned int vid, pid;
+	char *end;
+
+	memset(&ev, 0, sizeof(ev));
+	vid = strtoul(ids, &end, 16);
+	if (*end != ':')
+		return -1;
+	pid = strtoul(end + 1, &end, 16);
+	if (*end && *end != ':')
+		return -1;
+	if (*end)
+		snprintf((char *)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "%s", end + 1);
+
+	ev.type = UHID_CREATE2;
+	snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name), "cybtldrsim HID bootloader");
+	ev.u.create2.rd_size = sizeof(hid_report_desc);
+	memcpy(ev.u.create2.rd_data, hid_report_desc, sizeof(hid_report_desc));
+	ev.u.create2.bus = BUS_USB;
+	ev.u.create2.vendor = vid;
+	ev.u.create2.product = pid;
+	if (sim_uhid_send(fd, &ev))
+		return -1;
+	printf("hid:%04x:%04x%s%s\n", vid, pid, *end ? ":" : "", *end ? end + 1 : "");
+
+	return 0;
+}
+
+/* Send a response in as many input reports as needed, the last one padded */
+static int sim_uhid_input(int fd, const unsigned char *buf, unsigned long size)
+{
+	struct uhid_event ev;
+	unsigned long len;
+
+	while (size) {
+		len = size < HID_REPORT_SIZE ? size : HID_REPORT_SIZE;
+		memset(&ev, 0, sizeof(ev));
+		ev.type = UHID_INPUT2;
+		ev.u.input2.size = HID_REPORT_SIZE;
+		memcpy(ev.u.input2.data, buf, len);
+		if (sim_uhid_send(fd, &ev))
+			return -1;
+		buf += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+/*
+ * Handle an event of the HID device, copy the packet of an output report to
+ * buf.  Returns the number of bytes copied, or -1 on error.
+ */
+static ssize_t sim_uhid_event(int fd, unsigned char *buf, unsigned long size)
+{
+	struct uhid_event ev;
+	ssize_t ret;
+
+	ret = read(fd, &ev, sizeof(ev));
+	if (ret <= 0)
+		return ret;
+
+	switch (ev.type) {
+	case UHID_OUTPUT:
+		/* The report number comes first, always 0 */
+		if (ev.u.output.rtype != UHID_OUTPUT_REPORT || ev.u.output.size < 1)
+			return 0;
+		ret = ev.u.output.size - 1;
+		if ((unsigned long)ret > size)
+			ret = size;
+		memcpy(buf, ev.u.output.data + 1, ret);
+		return ret;
+	case UHID_GET_REPORT:
+		/* Only the interrupt endpoints are used */
+		ev.u.get_report_reply.id = ev.u.get_report.id;
+		ev.u.get_report_reply.err = EIO;
+		ev.u.get_report_reply.size = 0;
+		ev.type = UHID_GET_REPORT_REPLY;
+		return sim_uhid_send(fd, &ev);
+	case UHID_SET_REPORT:
+		ev.u.set_report_reply.id = ev.u.set_report.id;
+		ev.u.set_report_reply.err = EIO;
+		ev.type = UHID_SET_REPORT_REPLY;
+		return sim_uhid_send(fd, &ev);
+	default:
+		if (g_verbose)
+			fprintf(stderr, "cybtldrsim: HID event %u\n", ev.type);
+		return 0;
+	}
+}
+
+/* Send a response packet, paced as the request and it would be on a serial line */
+static int sim_respond(struct sim_device *dev, int fd, unsigned long req_size,
+		       unsigned char status, const unsigned char *data, unsigned long size)
+{
+	unsigned char buf[MAX_COMMAND_SIZE];
+	unsigned short checksum;
+
+	buf[0] = CMD_START;
+	buf[1] = status;
+	buf[2] = (unsigned char)size;
+	buf[3] = (unsigned char)(size >> 8);
+	if (size)
+		memcpy(&buf[4], data, size);
+	checksum = dev->checksum(buf, size + 4);
+	buf[size + 4] = (unsigned char)checksum;
+	buf[size + 5] = (unsigned char)(checksum >> 8);
+	buf[size + 6] = CMD_STOP;
+
+	/* 10 bits per byte: start, 8 data bits and stop */
+	if (dev->baudrate)
+		sim_sleep_us((req_size + size + BASE_CMD_SIZE) * 10ULL * 1000000 / dev->baudrate);
+
+	if (dev->drop && ++dev->responses % dev->drop == 0) {
+		if (g_verbose)
+			fprintf(stderr, "cybtldrsim: dropping response\n");
+		return 0;
+	}
+
+	if (dev->uhid)
+		return sim_uhid_input(fd, buf, size + BASE_CMD_SIZE);
+
+	return sim_write(fd, buf, size + BASE_CMD_SIZE);
+}
+
+static int sim_row_index(struct sim_device *dev, const unsigned char *data,
+			 unsigned long size, unsigned char *status)
+{
+	unsigned int array_id, row_num;
+
+	if (size < 3) {
+		*status = CYBTLDR_STAT_ERR_LENGTH;
+		return -1;
+	}
+	array_id = data[0];
+	row_num = data[1] | (data[2] << 8);
+	if (array_id >= dev->arrays) {
+		*status = CYBTLDR_STAT_ERR_ARRAY;
+		return -1;
+	}
+	if (row_num < dev->first_row || row_num > dev->last_row) {
+		*status = CYBTLDR_STAT_ERR_ROW;
+		return -1;
+	}
+
+	return array_id * (dev->last_row + 1) + row_num;
+}
+
+/* The application is valid when it has been programmed without any bad row */
+static int sim_app_valid(struct sim_device *dev)
+{
+	unsigned int rows = dev->arrays * (dev->last_row + 1);
+	unsigned int i;
+	int valid = 0;
+
+	for (i = 0; i < rows; i++) {
+		if (dev->programmed[i] == 1)
+			valid = 1;
+		else if (dev->programmed[i] > 1)
+			return 0;
+	}
+
+	return valid;
+}
+
+static int sim_command(struct sim_device *dev, int fd, unsigned char cmd,
+		       const unsigned char *data, unsigned long size)
+{
+	unsigned long req_size = size + BASE_CMD_SIZE;
+	unsigned char status = CYBTLDR_STAT_SUCCESS;
+	unsigned char res[8];
+	unsigned long res_size = 0;
+	unsigned char *row;
+	unsigned int i;
+	int idx;
+
+	dev->stats[cmd]++;
+	if (g_verbose)
+		fprintf(stderr, "cybtldrsim: %s, %lu bytes\n", CyBtldr_GetCommandName(cmd), size);
+
+	/* Nothing is answered until the bootloader has been entered */
+	if (!dev->entered && cmd != CMD_ENTER_BOOTLOADER)
+		return 0;
+
+	if (req_size > dev->buffer_size)
+		return sim_respond(dev, fd, req_size, CYBTLDR_STAT_ERR_LENGTH, NULL, 0);
+
+	switch (cmd) {
+	case CMD_ENTER_BOOTLOADER:
+		if (dev->has_key && (size != KEY_BYTES || memcmp(data, dev->key, KEY_BYTES))) {
+			status = CYBTLDR_STAT_ERR_KEY;
+			break;
+		}
+		dev->entered = 1;
+		dev->row_buf_len = 0;
+		res[0] = (unsigned char)dev->silicon_id;
+		res[1] = (unsigned char)(dev->silicon_id >> 8);
+		res[2] = (unsigned char)(dev->silicon_id >> 16);
+		res[3] = (unsigned char)(dev->silicon_id >> 24);
+		res[4] = dev->silicon_rev;
+		res[5] = (unsigned char)dev->bl_version;
+		res[6] = (unsigned char)(dev->bl_version >> 8);
+		res[7] = (unsigned char)(dev->bl_version >> 16);
+		res_size = 8;
+		break;
+	case CMD_EXIT_BOOTLOADER:
+		dev->entered = 0;
+		sim_print_stats(dev);
+		return 0;
+	case CMD_SYNC:
+		dev->row_buf_len = 0;
+		return 0;
+	case CMD_GET_FLASH_SIZE:
+		if (size != 1) {
+			status = CYBTLDR_STAT_ERR_LENGTH;
+		} else if (data[0] >= dev->arrays) {
+			status = CYBTLDR_STAT_ERR_ARRAY;
+		} else {
+			res[0] = (unsigned char)dev->first_row;
+			res[1] = (unsigned char)(dev->first_row >> 8);
+			res[2] = (unsigned char)dev->last_row;
+			res[3] = (unsigned char)(dev->last_row >> 8);
+			res_size = 4;
+		}
+		break;
+	case CMD_SEND_DATA:
+		if (dev->row_buf_len + size > dev->row_size) {
+			dev->row_buf_len = 0;
+			status = CYBTLDR_STAT_ERR_LENGTH;
+			break;
+		}
+		memcpy(&dev->row_buf[dev->row_buf_len], data, size);
+		dev->row_buf_len += size;
+		break;
+	case CMD_PROGRAM_ROW:
+		idx = sim_row_index(dev, data, size, &status);
+		if (idx >= 0 && dev->row_buf_len + size - 3 != dev->row_size)
+			status = CYBTLDR_STAT_ERR_LENGTH;
+		if (status == CYBTLDR_STAT_SUCCESS) {
+			row = &dev->flash[idx * dev->row_size];
+			memcpy(row, dev->row_buf, dev->row_buf_len);
+			memcpy(row + dev->row_buf_len, data + 3, size - 3);
+			/* A corrupt row keeps being reported bad by the application checksum */
+			if (dev->corrupt[idx])
+				row[0] ^= 0x01;
+			dev->programmed[idx] = dev->corrupt[idx] ? 2 : 1;
+			if (dev->write_latency)
+				sim_sleep_us(dev->write_latency);
+		}
+		dev->row_buf_len = 0;
+		break;
+	case CMD_ERASE_ROW:
+		idx = sim_row_index(dev, data, size, &status);
+		if (status == CYBTLDR_STAT_SUCCESS) {
+			memset(&dev->flash[idx * dev->row_size], 0, dev->row_size);
+			dev->programmed[idx] = 0;
+			if (dev->write_latency)
+				sim_sleep_us(dev->write_latency);
+		}
+		break;
+	case CMD_VERIFY_ROW:
+		idx = sim_row_index(dev, data, size, &status);
+		if (status == CYBTLDR_STAT_SUCCESS) {
+			row = &dev->flash[idx * dev->row_size];
+			res[0] = 0;
+			for (i = 0; i < dev->row_size; i++)
+				res[0] -= row[i];
+			res_size = 1;
+		}
+		break;
+	case CMD_VERIFY_CHECKSUM:
+		res[0] = sim_app_valid(dev);
+		res_size = 1;
+		break;
+	case CMD_GET_APP_STATUS:
+	case CMD_SET_ACTIVE_APP:
+		if (!dev->multi_app) {
+			status = CYBTLDR_STAT_ERR_CMD;
+		} else if (size != 1) {
+			status = CYBTLDR_STAT_ERR_LENGTH;
+		} else if (data[0] >= APP_COUNT) {
+			status = CYBTLDR_STAT_ERR_APP;
+		} else if (cmd == CMD_SET_ACTIVE_APP) {
+			dev->active_app = data[0];
+		} else {
+			/* Both applications share the simulated flash, the active
+			 * one is always valid.  The bootloader reports a valid
+			 * application with 0 */
+			res[0] = data[0] == dev->active_app ? 0 : !sim_app_valid(dev);
+			res[1] = data[0] == dev->active_app;
+			res_size = 2;
+		}
+		break;
+	default:
+		status = CYBTLDR_STAT_ERR_CMD;
+		break;
+	}
+
+	return sim_respond(dev, fd, req_size, status, res, res_size);
+}
+
+/*
+ * Frame the received bytes in packets and run them.  Returns the number of
+ * bytes consumed, or -1 on write error.
+ */
+static long sim_process(struct sim_device *dev, int fd, const unsigned char *buf, unsigned long len)
+{
+	unsigned long pos = 0;
+	unsigned long size;
+	unsigned short checksum;
+
+	while (pos < len) {
+		/* Resynchronize on the start of packet */
+		if (buf[pos] != CMD_START) {
+			pos++;
+			continue;
+		}
+		if (len - pos < BASE_CMD_SIZE)
+			break;
+		size = buf[pos + 2] | (buf[pos + 3] << 8);
+		if (len - pos < size + BASE_CMD_SIZE)
+			break;
+
+		checksum = buf[pos + size + 4] | (buf[pos + size + 5] << 8);
+		if (buf[pos + size + 6] != CMD_STOP) {
+			if (dev->entered && sim_respond(dev, fd, 0, CYBTLDR_STAT_ERR_DATA, NULL, 0))
+				return -1;
+		} else if (checksum != dev->checksum(&buf[pos], size + 4)) {
+			if (dev->entered && sim_respond(dev, fd, 0, CYBTLDR_STAT_ERR_CHECKSUM, NULL, 0))
+				return -1;
+		} else if (sim_command(dev, fd, buf[pos + 1], &buf[pos + 4], size)) {
+			return -1;
+		}
+		pos += size + BASE_CMD_SIZE;
+	}
+
+	return pos;
+}
+
+static int parse_key(const char *str, unsigned char *key)
+{
+	char *end;
+	int i;
+
+	for (i = 0; i < KEY_BYTES; i++) {
+		key[i] = strtoul(str, &end, 0);
+		if (*end == '\0')
+			return i == KEY_BYTES - 1 ? 0 : -1;
+		str = end + 1;
+	}
+
+	return -1;
+}
+
+/* Listen on the loopback interface, port 0 picks a free port */
+static int sim_listen(int port)
+{
+	struct sockaddr_in addr = {0};
+	socklen_t len = sizeof(addr);
+	int fd, on = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 1) ||
+	    getsockname(fd, (struct sockaddr *)&addr, &len)) {
+		perror("Can not listen");
+		close(fd);
+		return -1;
+	}
+	printf("tcp://127.0.0.1:%u\n", ntohs(addr.sin_port));
+
+	return fd;
+}
+
+static int sim_accept(int listener)
+{
+	int fd, on = 1;
+
+	fd = accept(listener, NULL, NULL);
+	if (fd < 0)
+		return -1;
+	/* Responses are sent as soon as they are written, as on a serial line */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	if (g_verbose)
+		fprintf(stderr, "Host connected\n");
+
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	struct cybtldrsim_args_info args_info;
+	struct sim_device dev = {0};
+	static unsigned char rx[RX_BUF_SIZE];
+	unsigned long rx_len = 0;
+	struct sigaction sa = {0};
+	struct termios tio;
+	struct pollfd pfd;
+	unsigned int rows, i;
+	const char *slave;
+	int master = -1, slave_fd = -1, listener = -1;
+	ssize_t ret;
+	long used;
+
+	if (cybtldrsim_cmdline_parser(argc, argv, &args_info) != 0)
+		return EXIT_FAILURE;
+
+	g_verbose = args_info.verbose_given;
+	dev.silicon_id = strtoul(args_info.silicon_id_arg, NULL, 0);
+	dev.silicon_rev = strtoul(args_info.silicon_rev_arg, NULL, 0);
+	dev.bl_version = strtoul(args_info.bl_version_arg, NULL, 0);
+	dev.arrays = args_info.arrays_arg;
+	dev.first_row = args_info.first_row_arg;
+	dev.last_row = args_info.last_row_arg;
+	dev.row_size = args_info.row_size_arg;
+	dev.buffer_size = args_info.buffer_size_arg;
+	dev.write_latency = args_info.write_latency_arg;
+	dev.baudrate = args_info.baudrate_arg;
+	dev.drop = args_info.drop_arg > 0 ? args_info.drop_arg : 0;
+	dev.multi_app = args_info.multi_app_given;
+	/* The device runs the last application, the first one can be programmed */
+	dev.active_app = APP_COUNT - 1;
+	dev.checksum = CyBtldr_GetChecksumFunc(args_info.crc_given ? CRC_CHECKSUM : SUM_CHECKSUM);
+
+	if (args_info.arrays_arg < 1 || args_info.arrays_arg > 256 ||
+	    args_info.first_row_arg < 0 || args_info.last_row_arg > 0xffff ||
+	    args_info.first_row_arg > args_info.last_row_arg) {
+		fprintf(stderr, "Invalid flash geometry\n");
+		return EXIT_FAILURE;
+	}
+	if (args_info.row_size_arg < 1 || args_info.row_size_arg > 0xffff) {
+		fprintf(stderr, "Invalid row size %d\n", args_info.row_size_arg);
+		return EXIT_FAILURE;
+	}
+	if (args_info.buffer_size_arg < BASE_CMD_SIZE + 8 || args_info.buffer_size_arg > MAX_COMMAND_SIZE) {
+		fprintf(stderr, "Buffer size must be between %d and %d\n", BASE_CMD_SIZE + 8, MAX_COMMAND_SIZE);
+		return EXIT_FAILURE;
+	}
+	if (args_info.key_given) {
+		if (parse_key(args_info.key_arg, dev.key)) {
+			fprintf(stderr, "Invalid key %s\n", args_info.key_arg);
+			return EXIT_FAILURE;
+		}
+		dev.has_key = 1;
+	}
+
+	rows = dev.arrays * (dev.last_row + 1);
+	dev.flash = calloc(rows, dev.row_size);
+	dev.programmed = calloc(rows, 1);
+	dev.corrupt = calloc(rows, 1);
+	dev.row_buf = malloc(dev.row_size);
+	if (!dev.flash || !dev.programmed || !dev.corrupt || !dev.row_buf) {
+		fprintf(stderr, "Can not allocate %u rows of flash\n", rows);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < args_info.corrupt_row_given; i++) {
+		if (args_info.corrupt_row_arg[i] >= 0 && args_info.corrupt_row_arg[i] < rows)
+			dev.corrupt[args_info.corrupt_row_arg[i]] = 1;
+	}
+
+	if (args_info.tcp_given) {
+		listener = sim_listen(args_info.tcp_arg);
+		if (listener < 0)
+			return EXIT_FAILURE;
+	} else if (args_info.uhid_given) {
+		master = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+		if (master < 0) {
+			perror("Can not open /dev/uhid");
+			return EXIT_FAILURE;
+		}
+		if (sim_uhid_create(master, args_info.uhid_arg)) {
+			fprintf(stderr, "Can not create HID device %s\n", args_info.uhid_arg);
+			return EXIT_FAILURE;
+		}
+		dev.uhid = 1;
+	} else {
+		master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (master < 0 || grantpt(master) || unlockpt(master) || !(slave = ptsname(master))) {
+			perror("Can not create pseudo terminal");
+			return EXIT_FAILURE;
+		}
+
+		/* Keep the slave open so that the master does not hang up between host runs */
+		slave_fd = open(slave, O_RDWR | O_NOCTTY);
+		if (slave_fd < 0 || tcgetattr(slave_fd, &tio)) {
+			perror("Can not open pseudo terminal");
+			return EXIT_FAILURE;
+		}
+		cfmakeraw(&tio);
+		tcsetattr(slave_fd, TCSANOW, &tio);
+
+		if (args_info.link_given) {
+			unlink(args_info.link_arg);
+			if (symlink(slave, args_info.link_arg)) {
+				perror("Can not create link");
+				return EXIT_FAILURE;
+			}
+		}
+		printf("%s\n", slave);
+	}
+	fflush(stdout);
+
+	sa.sa_handler = sim_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	/* A host going away is reported by write() */
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	pfd.events = POLLIN;
+	while (!g_stop) {
+		/* Wait for the next host when none is connected */
+		pfd.fd = master >= 0 ? master : listener;
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (master < 0) {
+			master = sim_accept(listener);
+			rx_len = 0;
+			continue;
+		}
+
+		if (dev.uhid)
+			ret = sim_uhid_event(master, rx + rx_len, sizeof(rx) - rx_len);
+		else
+			ret = read(master, rx + rx_len, sizeof(rx) - rx_len);
+		if (listener >= 0 && (ret == 0 || (ret < 0 && errno == ECONNRESET))) {
+			if (g_verbose)
+				fprintf(stderr, "Host disconnected\n");
+			close(master);
+			master = -1;
+			continue;
+		}
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EIO)
+				continue;
+			perror("read");
+			break;
+		}
+		rx_len += ret;
+
+		used = sim_process(&dev, master, rx, rx_len);
+		if (used < 0 && listener >= 0 && (errno == EPIPE || errno == ECONNRESET)) {
+			close(master);
+			master = -1;
+			continue;
+		}
+		if (used < 0) {
+			perror("write");
+			break;
+		}
+		rx_len -= used;
+		memmove(rx, rx + used, rx_len);
+	}
+
+	sim_print_stats(&dev);
+	if (args_info.link_given && !args_info.tcp_given && !args_info.uhid_given)
+		unlink(args_info.link_arg);
+	if (slave_fd >= 0)
+		close(slave_fd);
+	if (master >= 0)
+		close(master);
+	if (listener >= 0)
+		close(listener);
+	free(dev.flash);
+	free(dev.programmed);
+	free(dev.corrupt);
+	free(dev.row_buf);
+
+	return g_stop ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,155 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+static int cache_path(const char *file, char *path, size_t size)
+{
+	const char *dir = getenv("XDG_CACHE_HOME");
+
+	if (dir && dir[0]) {
+		mkdir(dir, 0755);
+		snprintf(path, size, "%s/cyhostboot", dir);
+	} else {
+		dir = getenv("HOME");
+		if (!dir)
+			return 1;
+		snprintf(path, size, "%s/.cache", dir);
+		mkdir(path, 0755);
+		snprintf(path, size, "%s/.cache/cyhostboot", dir);
+	}
+	mkdir(path, 0755);
+	strncat(path, "/", size - strlen(path) - 1);
+	strncat(path, file, size - strlen(path) - 1);
+
+	return 0;
+}
+
+/*
+ * Lock the cache file through a lock file next to it, which unlike the cache
+ * file is never replaced. Return the lock file descriptor, or -1 on error.
+ */
+static int cache_lock(const char *path, int operation)
+{
+	char lock_path[PATH_MAX + 8];
+	int fd;
+
+	snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+	fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	if (flock(fd, operation)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Return the value of the line if it holds the key, NULL otherwise */
+static char *cache_match(char *line, const char *key)
+{
+	size_t len = strlen(key);
+
+	if (strncmp(line, key, len) != 0 || line[len] != ' ')
+		return NULL;
+	line[strcspn(line, "\n")] = '\0';
+
+	return &line[len + 1];
+}
+
+int cache_get(const char *file, const char *key, char *value, size_t size)
+{
+	char path[PATH_MAX], line[2 * PATH_MAX];
+	char *found = NULL;
+	FILE *cache;
+	int lock;
+
+	if (cache_path(file, path, sizeof(path)))
+		return 0;
+
+	lock = cache_lock(path, LOCK_SH);
+	if (lock < 0)
+		return 0;
+	cache = fopen(path, "r");
+	if (cache) {
+		while (!found && fgets(line, sizeof(line), cache))
+			found = cache_match(line, key);
+		fclose(cache);
+	}
+	if (found)
+		snprintf(value, size, "%s", found);
+	close(lock);
+
+	return found != NULL;
+}
+
+/* Rewrite the cache file with the new value of the key, taking its lock with
+ * the given flock() operation. Return 0 if the value was written. */
+static int cache_update(const char *file, const char *key, const char *value, int operation)
+{
+	char path[PATH_MAX], tmp_path[PATH_MAX + 8];
+	char line[2 * PATH_MAX];
+	FILE *cache, *tmp;
+	int lock, fd, ret = 1;
+
+	if (cache_path(file, path, sizeof(path)))
+		return 1;
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+	/* Held until the new file replaced the old one, for the whole read-modify-write */
+	lock = cache_lock(path, operation);
+	if (lock < 0)
+		return 1;
+	fd = mkstemp(tmp_path);
+	if (fd < 0)
+		goto out;
+	fchmod(fd, 0644);
+	tmp = fdopen(fd, "w");
+	if (!tmp) {
+		close(fd);
+		unlink(tmp_path);
+		goto out;
+	}
+
+	/* Rewrite the other keys, then the new value */
+	cache = fopen(path, "r");
+	if (cache) {
+		while (fgets(line, sizeof(line), cache)) {
+			if (!strchr(line, ' '))
+				continue;
+			if (!cache_match(line, key)) {
+				fputs(line, tmp);
+				if (!strchr(line, '\n'))
+					fputc('\n', tmp);
+			}
+		}
+		fclose(cache);
+	}
+	if (value)
+		fprintf(tmp, "%s %s\n", key, value);
+	if (fclose(tmp) || rename(tmp_path, path))
+		unlink(tmp_path);
+	else
+		ret = 0;
+out:
+	close(lock);
+
+	return ret;
+}
+
+void cache_set(const char *file, const char *key, const char *value)
+{
+	cache_update(file, key, value, LOCK_EX);
+}
+
+int cache_try_set(const char *file, const char *key, const char *value)
+{
+	return cache_update(file, key, value, LOCK_EX | LOCK_NB) == 0;
+}
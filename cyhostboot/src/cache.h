@@ -0,0 +1,29 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+
+/**
+ * Small persistent key/value files kept in $XDG_CACHE_HOME/cyhostboot (or
+ * ~/.cache/cyhostboot), holding one "<key> <value>" line per key. Keys can
+ * not contain spaces. Accesses are serialized with a lock file so that they can
+ * be done from several threads and processes.
+ */
+
+/**
+ * Look a key up, return 1 and copy its value if found, 0 otherwise
+ */
+int cache_get(const char *file, const char *key, char *value, size_t size);
+
+/**
+ * Set the value of a key, or remove the key if value is NULL
+ */
+void cache_set(const char *file, const char *key, const char *value);
+
+/**
+ * Set the value of a key as cache_set() does, unless another process holds
+ * the cache: return 1 if the value was written, 0 otherwise
+ */
+int cache_try_set(const char *file, const char *key, const char *value);
+
+#endif
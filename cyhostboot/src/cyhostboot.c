@@ -1,209 +1,887 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <termios.h>
 #include <time.h>
-#include <poll.h>
 #include <errno.h>
+#include <sys/resource.h>
+#include <glob.h>
+#include <sys/epoll.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include <cybtldr_api.h>
 #include <cybtldr_api2.h>
+#include <cybtldr_command.h>
+#include <cybtldr_parse.h>
 
 #include <cyhostboot_cmdline.h>
 
+#include "cache.h"
+#include "cyhostboot.h"
+#include "serial.h"
+#include "serial_hid.h"
+#include "serial_tcp.h"
 
-#ifdef DEBUG
-#define dbg_printf(fmt, args...)    printf(fmt, ## args)
-#else
-#define dbg_printf(fmt, args...)    /* Don't do anything in release builds */
-#endif
-
-#define TRANSFER_SIZE	64
 #define KEY_BYTES       6
+/* Response timeout used when probing baudrates, in milliseconds */
+#define PROBE_TIMEOUT	100
+#define BAUDRATE_CACHE_FILE	"baudrates"
+#define CHECKPOINT_FILE		"checkpoints"
+/* Number of rows programmed between two checkpoints */
+#define CHECKPOINT_INTERVAL	16
+/* Highest number of retries of a packet */
+#define MAX_RETRIES		20
+#define DEFAULT_SERIAL_PORT	"/dev/ttyACM0"
+/* Smallest packet leaving room for data after the program row header */
+#define MIN_TRANSFER_SIZE	16
+/* io_uring entries a port can have queued: write, read, its timeout and a
+ * cancellation of the read */
+#define URING_ENTRIES_PER_PORT	4
 
 static struct cyhostboot_args_info args_info;
 
 /**
- * No context for callback itnerface... use a shared var.
+ * Candidate baudrates for automatic detection, fastest first
+ */
+static const int probe_baudrates[] = {
+	921600, 460800, 230400, 115200, 57600, 38400, 19200, 9600,
+};
+
+/**
+ * Check if the bootloader answers at the given baudrate by sending it an
+ * enter bootloader command. Any well formed response packet means the
+ * baudrate is right, even if the bootloader reported an error status.
+ */
+static int serial_probe_baudrate(CyBtldr_Session *session, struct serial_port *port,
+				 int baudrate, const unsigned char *key)
+{
+	unsigned char inBuf[MAX_COMMAND_SIZE];
+	unsigned char outBuf[MAX_COMMAND_SIZE];
+	unsigned long inSize, outSize, siliconId, blVer;
+	unsigned char siliconRev, status = CYRET_SUCCESS;
+	CyBtldr_CommunicationsData *comm = session->comm;
+	int ret, timeout = port->timeout;
+
+	printf("Probing baudrate %d\n", baudrate);
+	port->baudrate = baudrate;
+	if (comm->OpenConnection(comm->Context) != CYRET_SUCCESS) {
+		if (port->fd >= 0)
+			comm->CloseConnection(comm->Context);
+		return 1;
+	}
+
+	/* Go through the session so that the probe does not block asynchronous jobs */
+	port->timeout = PROBE_TIMEOUT;
+	CyBtldr_CreateEnterBootLoaderCmd(session, inBuf, &inSize, &outSize, key);
+	ret = comm->WriteData(comm->Context, inBuf, inSize);
+	if (ret == CYRET_SUCCESS)
+		ret = comm->ReadData(comm->Context, outBuf, outSize);
+	if (ret == CYRET_SUCCESS &&
+	    CyBtldr_ParseEnterBootLoaderCmdResult(outBuf, outSize, &siliconId, &siliconRev, &blVer, &status) != CYRET_SUCCESS)
+		ret = CyBtldr_TryParseParketStatus(session, outBuf, outSize, &status);
+	port->timeout = timeout;
+
+	comm->CloseConnection(comm->Context);
+
+	return ret;
+}
+
+/**
+ * The baudrate cache holds the last baudrate detected on each serial port
+ */
+static int baudrate_cache_get(const char *serial)
+{
+	char value[16];
+
+	return cache_get(BAUDRATE_CACHE_FILE, serial, value, sizeof(value)) ? atoi(value) : 0;
+}
+
+static void baudrate_cache_set(const char *serial, int baudrate)
+{
+	char value[16];
+
+	snprintf(value, sizeof(value), "%d", baudrate);
+	cache_set(BAUDRATE_CACHE_FILE, serial, value);
+}
+
+/**
+ * Find the baudrate the bootloader is listening at, trying the cached one
+ * for this serial port first and then sweeping the candidates.
+ */
+static int serial_detect_baudrate(CyBtldr_Session *session, struct serial_port *port,
+				  const unsigned char *key)
+{
+	const char *serial = port->name;
+	unsigned int i;
+	int cached;
+
+	cached = baudrate_cache_get(serial);
+
+	if (cached && serial_probe_baudrate(session, port, cached, key) == CYRET_SUCCESS)
+		return cached;
+
+	for (i = 0; i < sizeof(probe_baudrates) / sizeof(probe_baudrates[0]); i++) {
+		if (probe_baudrates[i] == cached)
+			continue;
+		if (serial_probe_baudrate(session, port, probe_baudrates[i], key) == CYRET_SUCCESS) {
+			baudrate_cache_set(serial, probe_baudrates[i]);
+			return probe_baudrates[i];
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Identify the image in the checkpoints, with a FNV-1a hash of the device it
+ * is built for and of its rows
+ */
+static void hash_bytes(unsigned long long *hash, const void *bytes, size_t size)
+{
+	const unsigned char *p = bytes;
+
+	while (size--) {
+		*hash ^= *p++;
+		*hash *= 0x100000001b3ULL;
+	}
+}
+
+static unsigned long long image_hash(const CyBtldr_Image *image)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	const CyBtldr_Row *row;
+	unsigned int i;
+
+	hash_bytes(&hash, &image->siliconId, sizeof(image->siliconId));
+	hash_bytes(&hash, &image->siliconRev, sizeof(image->siliconRev));
+	hash_bytes(&hash, &image->checksumType, sizeof(image->checksumType));
+	for (i = 0; i < image->rowCount; i++) {
+		row = &image->rows[i];
+		hash_bytes(&hash, &row->arrayId, sizeof(row->arrayId));
+		hash_bytes(&hash, &row->rowNum, sizeof(row->rowNum));
+		hash_bytes(&hash, &row->size, sizeof(row->size));
+		hash_bytes(&hash, row->data, row->size);
+	}
+
+	return hash;
+}
+
+/**
+ * The checkpoints hold, for each serial port, the hash of the image being
+ * programmed and the number of rows of it written so far
+ */
+static unsigned int checkpoint_get(const char *serial, unsigned long long hash)
+{
+	unsigned long long saved_hash;
+	unsigned int rows;
+	char value[64];
+
+	if (!cache_get(CHECKPOINT_FILE, serial, value, sizeof(value)) ||
+	    sscanf(value, "%llx %u", &saved_hash, &rows) != 2 || saved_hash != hash)
+		return 0;
+
+	return rows;
+}
+
+static void checkpoint_set(const char *serial, unsigned long long hash, unsigned int rows)
+{
+	char value[64];
+
+	snprintf(value, sizeof(value), "%016llx %u", hash, rows);
+	cache_set(CHECKPOINT_FILE, serial, value);
+}
+
+static int checkpoint_try_set(const char *serial, unsigned long long hash, unsigned int rows)
+{
+	char value[64];
+
+	snprintf(value, sizeof(value), "%016llx %u", hash, rows);
+	return cache_try_set(CHECKPOINT_FILE, serial, value);
+}
+
+/**
+ * A flash operation running on one serial port
  */
-static int g_serial_fd = -1;
+struct flash_job {
+	struct serial_port port;
+	CyBtldr_CommunicationsData comms;
+	CyBtldr_Session session;
+	/* Used when several ports are driven from the event loop */
+	CyBtldr_AsyncCommunications async_comms;
+	CyBtldr_AsyncOperation op;
+	unsigned long long start_us;
+	int result;
+	unsigned long long duration_us;
+	/* Start of the action and of the last progress report, with the bytes
+	 * exchanged on the port at start */
+	unsigned long long progress_start_us;
+	unsigned long long progress_last_us;
+	unsigned long progress_wire_bytes;
+	/* Set when the job runs in the event loop of flash_jobs_run() */
+	unsigned char async;
+	/* Rows of the last checkpoint recorded while programming, and of the
+	 * last one saved */
+	unsigned int checkpoint_rows;
+	unsigned int checkpoint_saved;
+	/* State of the job in the event loop: whether it is to be polled, its
+	 * deadline and place in the deadline heap (-1 if none), and the handle,
+	 * events and port opening it is registered with in epoll (-1 if none) */
+	unsigned char pending;
+	unsigned long long deadline;
+	int heap_index;
+	int epoll_fd;
+	unsigned char epoll_events;
+	unsigned int epoll_opens;
+};
+
+static CyBtldr_Action g_action = PROGRAM;
+static const char *g_action_str = "programing";
+static const unsigned char *g_key;
+/* The file to flash, shared by all jobs */
+static CyBtldr_Image g_image;
+static unsigned long long g_image_hash;
+/* Actions run in a single bootloader session: the main one, then the --then
+ * ones, with the files of their images */
+static CyBtldr_Step *g_steps;
+static const char **g_step_files;
+static unsigned int g_step_count;
+/* Minimum time between two progress reports of a port */
+static unsigned long long g_progress_interval_us = PROGRESS_INTERVAL_US;
+static volatile sig_atomic_t g_interrupted;
+
+static unsigned long long now_us(void)
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return timespec_microseconds(&tp);
+}
+
+static void progress_start(struct flash_job *job)
+{
+	job->progress_start_us = now_us();
+	job->progress_last_us = job->progress_start_us;
+	job->progress_wire_bytes = job->port.tx_bytes + job->port.rx_bytes;
+}
+
+/* Rows of the image written so far, counting the ones before the resume point */
+static unsigned int rows_programmed(const CyBtldr_Session *session)
+{
+	return session->resumedRow + session->progress.rowsDone;
+}
+
+/*
+ * Row to resume from after a failed programming: the one that failed if it is
+ * known, none if all rows were written but the application checksum is wrong
+ */
+static unsigned int resume_row(const CyBtldr_Session *session, int ret)
+{
+	if (session->errRowValid)
+		return session->errRowIdx;
+	if (ret == CYRET_ERR_CHECKSUM)
+		return 0;
+	return rows_programmed(session);
+}
+
+/**
+ * Save the last checkpoint recorded if it was not yet. The save is skipped
+ * rather than waited for when another process holds the cache, and tried
+ * again at the next call.
+ */
+static void flash_job_save_checkpoint(struct flash_job *job)
+{
+	if (job->checkpoint_rows != job->checkpoint_saved &&
+	    checkpoint_try_set(job->port.name, g_image_hash, job->checkpoint_rows))
+		job->checkpoint_saved = job->checkpoint_rows;
+}
+
+/**
+ * Record a checkpoint from time to time while programming, then report the rows
+ * and bytes done, the rates and the time left. Reports are throttled so that
+ * a slow terminal does not slow down the flashing.
+ */
+static void serial_progress_update(CyBtldr_Session *session, unsigned char arrayId, unsigned short rowNum)
+{
+	struct flash_job *job = container_of(session, struct flash_job, session);
+	const CyBtldr_Progress *progress = &session->progress;
+	unsigned long long now = now_us();
+	double elapsed, wire_rate, eta = 0;
+
+	/* The event loop saves the checkpoints of its jobs, which must not wait
+	 * for the disk */
+	if (g_action == PROGRAM && g_step_count == 1 && progress->rowsDone % CHECKPOINT_INTERVAL == 0) {
+		job->checkpoint_rows = rows_programmed(session);
+		if (!job->async)
+			flash_job_save_checkpoint(job);
+	}
+
+	if (progress->rowsDone < progress->rowCount &&
+	    now - job->progress_last_us < g_progress_interval_us)
+		return;
+	job->progress_last_us = now;
+
+	elapsed = (now - job->progress_start_us) / 1e6;
+	if (elapsed <= 0)
+		return;
+	wire_rate = (job->port.tx_bytes + job->port.rx_bytes - job->progress_wire_bytes) / elapsed;
+	if (progress->bytesDone)
+		eta = elapsed * (progress->byteCount - progress->bytesDone) / progress->bytesDone;
 
-static unsigned long long timespec_milliseconds(struct timespec *a)
+	printf("%s: %u/%u rows, %lu/%lu bytes, %.1f rows/s, %.1f kB/s on the wire, ETA %.1fs\n",
+	       job->port.name, progress->rowsDone, progress->rowCount, progress->bytesDone,
+	       progress->byteCount, progress->rowsDone / elapsed, wire_rate / 1000, eta);
+}
+
+static const char *action_str(CyBtldr_Action action)
 {
-	return a->tv_sec*1000 + a->tv_nsec/1000000;
+	switch (action) {
+	case ERASE: return "erasing";
+	case VERIFY: return "verifying";
+	default: return "programing";
+	}
 }
 
-static speed_t get_serial_speed(int baudrate)
+/* Describe all the steps of the session, "erasing then programing" */
+static char *steps_str(void)
 {
-	switch (baudrate) {
-		case 9600: return B9600;
-		case 19200: return B19200;
-		case 38400: return B38400;
-		case 57600: return B57600;
-		case 115200: return B115200;
-		default:
-			printf("Invalid baudrate %d\n", baudrate);
-			exit(EXIT_FAILURE);
-	};
+	unsigned int i;
+	size_t len = 1;
+	char *str;
+
+	for (i = 0; i < g_step_count; i++)
+		len += strlen(" then ") + strlen(action_str(g_steps[i].action));
+	str = malloc(len);
+	if (!str)
+		return NULL;
+
+	strcpy(str, action_str(g_steps[0].action));
+	for (i = 1; i < g_step_count; i++) {
+		strcat(str, " then ");
+		strcat(str, action_str(g_steps[i].action));
+	}
+
+	return str;
 }
 
-static int serial_open()
+static int load_image(const char *file, CyBtldr_Image *image)
 {
-	speed_t baudrate = get_serial_speed(args_info.baudrate_arg);
+	int ret;
 
-	g_serial_fd = open(args_info.serial_arg, O_RDWR);
-	if (g_serial_fd < 0) {
-		printf("Failed to open serial: %s\n", strerror(errno));
+	ret = CyBtldr_LoadImage(file, image);
+	if (ret != CYRET_SUCCESS) {
+		if (image->errLine)
+			printf("Invalid file %s, line %u: error 0x%x\n", file, image->errLine, ret);
+		else
+			printf("Failed to read file %s\n", file);
 		return 1;
 	}
-	// setting default baud rate and attributes
-	struct termios port_settings;
-	memset (&port_settings, 0, sizeof(port_settings));
-	cfsetispeed (&port_settings, baudrate);
-	cfsetospeed (&port_settings, baudrate);
-	if (args_info.odd_given) {
-		printf ("odd parity\n");
-		port_settings.c_cflag |= PARENB; // enable parity
-		port_settings.c_cflag |= PARODD; // enable odd parity => enable odd parity
-	} else if (args_info.even_given) {
-		printf ( "even parity\n");
-		port_settings.c_cflag |= PARENB; // enable parity
-		port_settings.c_cflag &= ~PARODD; // disable odd parity => enable even parity
+
+	return 0;
+}
+
+/**
+ * Parse a --then step, ACTION[:FILE[:APP_ID]], the file and application id of
+ * the previous step being used when left out, and load its file unless an
+ * earlier step uses the same one
+ */
+static int parse_step(const char *arg, unsigned int index)
+{
+	CyBtldr_Step *step = &g_steps[index];
+	char *action = strdup(arg), *file, *app_id;
+	CyBtldr_Image *image;
+	unsigned int i;
+
+	*step = g_steps[index - 1];
+	g_step_files[index] = g_step_files[index - 1];
+
+	file = strchr(action, ':');
+	if (file)
+		*file++ = '\0';
+	if (strcmp(action, "program") == 0) {
+		step->action = PROGRAM;
+	} else if (strcmp(action, "erase") == 0) {
+		step->action = ERASE;
+	} else if (strcmp(action, "verify") == 0) {
+		step->action = VERIFY;
 	} else {
-		printf ("no parity\n");
-		port_settings.c_cflag &= ~PARENB; // disable parity
-	}
-	port_settings.c_cflag &= ~CSTOPB; // disable extra stop bit => one stop bit
-	port_settings.c_cflag |= CS8; // 8 bits per byte
-	port_settings.c_cflag &= ~CRTSCTS; // Disable RTS/CTS hardware flow control
-	port_settings.c_cflag |= CREAD | CLOCAL; // turn on read and disable ctrl lines
-	port_settings.c_lflag &= ~ICANON; // disable canonical mode
-	port_settings.c_lflag &= ~(ECHO | ECHOE | ECHONL); // disable any kind of echo
-	port_settings.c_lflag &= ~ISIG; // disable interruption of INTR, QUIT and SUSP
-	port_settings.c_iflag &= ~(IXON | IXOFF | IXANY); // turn off sw flow control
-	port_settings.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL); // Disable any special handling of received bytes
-	port_settings.c_oflag &= ~(OPOST); // Prevent special interpretation of output bytes (e.g. newline chars)
-	port_settings.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
-	port_settings.c_cc[VTIME] = 0; // do not wait, return immediately
-	port_settings.c_cc[VMIN] = 0; // return as soon as some data
-	if (tcsetattr(g_serial_fd, TCSAFLUSH, &port_settings) != 0) {
-		printf ("Error %i from tcsetattr: %s\n", errno, strerror(errno));
+		printf("Invalid step %s, expected program, erase or verify[:FILE[:APP_ID]]\n", arg);
 		return 1;
 	}
+	if (!file)
+		return 0;
 
-	return CYRET_SUCCESS;
+	/* The file name may hold colons, the application id is only digits */
+	app_id = strrchr(file, ':');
+	if (app_id && app_id[1] && strspn(app_id + 1, "0123456789") == strlen(app_id + 1)) {
+		*app_id++ = '\0';
+		step->appId = atoi(app_id);
+	}
+	if (!*file)
+		return 0;
+
+	g_step_files[index] = file;
+	for (i = 0; i < index; i++) {
+		if (strcmp(g_step_files[i], file) == 0) {
+			step->image = g_steps[i].image;
+			return 0;
+		}
+	}
+	image = malloc(sizeof(*image));
+	step->image = image;
+
+	return load_image(file, image);
 }
 
-static int serial_close()
+static int flash_job_do(struct flash_job *job)
 {
-	dbg_printf("Closing serial\n");
-	close(g_serial_fd);
+	unsigned int rows;
+	int ret;
+
+	if (strcmp(args_info.baudrate_arg, "auto") == 0 && !serial_is_tty(&job->port)) {
+		printf("%s: no baudrate to detect\n", job->port.name);
+	} else if (strcmp(args_info.baudrate_arg, "auto") == 0) {
+		/* Probe packets are built with the checksum type of the file */
+		CyBtldr_SetCheckSumType(&job->session, g_image.checksumType);
+		job->port.baudrate = serial_detect_baudrate(&job->session, &job->port, g_key);
+		if (!job->port.baudrate) {
+			printf("%s: failed to detect bootloader baudrate\n", job->port.name);
+			return CYRET_ERR_COMM_MASK;
+		}
+	}
 
-	return CYRET_SUCCESS;
+	if (args_info.resume_flag && g_action == PROGRAM) {
+		job->session.resumeRow = checkpoint_get(job->port.name, g_image_hash);
+		if (!job->session.resumeRow)
+			printf("%s: no checkpoint of this file, programming all rows\n", job->port.name);
+	}
+
+	printf("Start %s on serial %s, baudrate %d\n", g_action_str, job->port.name, job->port.baudrate);
+	progress_start(job);
+	ret = CyBtldr_RunSteps(&job->session, g_steps, g_step_count, g_key, serial_progress_update);
+	if (ret != CYRET_SUCCESS && g_step_count > 1)
+		printf("%s: step %u failed, %s %s\n", job->port.name, job->session.step + 1,
+		       action_str(g_steps[job->session.step].action), g_step_files[job->session.step]);
+	if (ret != CYRET_SUCCESS && job->session.errRowValid)
+		printf("%s: %s failed on array_id %d, row_num %d\n", job->port.name,
+		       action_str(g_steps[job->session.step].action), job->session.errArrayId,
+		       job->session.errRowNum);
+	if (job->session.resumedRow)
+		printf("%s: resumed after %u rows\n", job->port.name, job->session.resumedRow);
+	/* The final checkpoint replaces any recorded one left to save.
+	 * A run failing before any row is programmed keeps the last checkpoint. */
+	job->checkpoint_saved = job->checkpoint_rows;
+	if (ret == CYRET_SUCCESS && g_action != VERIFY) {
+		cache_set(CHECKPOINT_FILE, job->port.name, NULL);
+	} else if (g_action == PROGRAM && g_step_count == 1 && job->session.progress.rowsDone) {
+		rows = resume_row(&job->session, ret);
+		if (rows) {
+			checkpoint_set(job->port.name, g_image_hash, rows);
+			printf("%s: run again with --resume to continue after %u rows\n",
+			       job->port.name, rows);
+		} else {
+			cache_set(CHECKPOINT_FILE, job->port.name, NULL);
+		}
+	}
+	if (strcmp(args_info.transfer_size_arg, "auto") == 0 && g_action == PROGRAM)
+		printf("%s: transfer size %u bytes%s\n", job->port.name, job->session.comm->MaxTransferSize,
+		       job->session.transferSizeFallback ? " (no bigger packet accepted)" : "");
+	if (job->session.upToDate)
+		printf("%s: already up to date\n", job->port.name);
+	else if (job->session.flags & CYBTLDR_FLAG_DELTA_PROGRAM && g_action == PROGRAM)
+		printf("%s: skipped %u unchanged rows\n", job->port.name, job->session.skippedRows);
+	if (job->session.retries)
+		printf("%s: %u packet(s) sent again\n", job->port.name, job->session.retries);
+
+	return ret;
 }
 
-static int serial_read(unsigned char *bytes, int size)
+static void flash_job_run(struct flash_job *job)
 {
-	struct timespec tp;
-	unsigned long long start_milli = 0, end_milli = 0;
-	ssize_t read_bytes;
-	struct pollfd fds[1];
-	int poll_ret, i;
-	unsigned int cur_byte = 0;
-
-	while(1) {
-		fds[0].revents = 0;
-		fds[0].events = POLLIN | POLLPRI;
-		fds[0].fd = g_serial_fd;
-
-		clock_gettime(CLOCK_MONOTONIC, &tp);
-		end_milli = timespec_milliseconds(&tp);
-		/* If we have read at least one value, start timer before ending read */
-		if (start_milli && (end_milli - start_milli) > 100)
+	job->start_us = now_us();
+	job->result = flash_job_do(job);
+	job->duration_us = now_us() - job->start_us;
+}
+
+static int flash_job_async(CyBtldr_Session *session, void *arg)
+{
+	return flash_job_do(arg);
+}
+
+/**
+ * Jobs of the event loop waiting for a deadline, in a binary min-heap so that
+ * the next deadline is found and updated in O(log N)
+ */
+struct job_heap {
+	struct flash_job **jobs;
+	int count;
+};
+
+static void job_heap_place(struct job_heap *heap, struct flash_job *job, int i)
+{
+	heap->jobs[i] = job;
+	job->heap_index = i;
+}
+
+/* Move the job at i up or down to its place */
+static void job_heap_sift(struct job_heap *heap, int i)
+{
+	struct flash_job *job = heap->jobs[i];
+	int child;
+
+	while (i > 0 && heap->jobs[(i - 1) / 2]->deadline > job->deadline) {
+		job_heap_place(heap, heap->jobs[(i - 1) / 2], i);
+		i = (i - 1) / 2;
+	}
+	while ((child = 2 * i + 1) < heap->count) {
+		if (child + 1 < heap->count && heap->jobs[child + 1]->deadline < heap->jobs[child]->deadline)
+			child++;
+		if (heap->jobs[child]->deadline >= job->deadline)
 			break;
+		job_heap_place(heap, heap->jobs[child], i);
+		i = child;
+	}
+	job_heap_place(heap, job, i);
+}
+
+static void job_heap_set(struct job_heap *heap, struct flash_job *job, unsigned long long deadline)
+{
+	job->deadline = deadline;
+	if (job->heap_index < 0)
+		job_heap_place(heap, job, heap->count++);
+	job_heap_sift(heap, job->heap_index);
+}
+
+static void job_heap_remove(struct job_heap *heap, struct flash_job *job)
+{
+	int i = job->heap_index;
+
+	if (i < 0)
+		return;
+	job->heap_index = -1;
+	if (i < --heap->count) {
+		heap->jobs[i] = heap->jobs[heap->count];
+		job_heap_sift(heap, i);
+	}
+}
+
+/**
+ * Register the handle a job waits on in epoll, changing the registration only
+ * when the handle or the events changed. Closing a handle drops it from epoll,
+ * and its number may have been reused by another port since: the registration
+ * is only removed while the port still holds it.
+ */
+static void flash_job_watch(int epoll, struct flash_job *job, int fd, unsigned char events)
+{
+	struct epoll_event event = { 0 };
+	int registered = job->epoll_fd >= 0 && job->epoll_fd == job->port.fd &&
+			 job->epoll_opens == job->port.opens;
+
+	if (epoll < 0)
+		return;
+	if (!events)
+		fd = -1;
+	if (registered && fd == job->epoll_fd && events == job->epoll_events)
+		return;
+
+	if (registered && fd != job->epoll_fd)
+		epoll_ctl(epoll, EPOLL_CTL_DEL, job->epoll_fd, NULL);
+	if (fd >= 0) {
+		event.events = (events & CYBTLDR_ASYNC_READABLE ? EPOLLIN : 0) |
+			       (events & CYBTLDR_ASYNC_WRITABLE ? EPOLLOUT : 0);
+		event.data.ptr = job;
+		epoll_ctl(epoll, registered && fd == job->epoll_fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+			  fd, &event);
+	}
+	job->epoll_fd = fd;
+	job->epoll_events = events;
+	job->epoll_opens = job->port.opens;
+}
+
+/* Queue a job to be polled for what it waits for next */
+static void flash_job_pend(struct flash_job *job, struct flash_job **pending, int *pending_count)
+{
+	if (job->result == CYRET_AGAIN && !job->pending) {
+		job->pending = 1;
+		pending[(*pending_count)++] = job;
+	}
+}
 
-		/* Check if there is data to read from serial */
-		poll_ret = poll(fds, 1, 0);
-		if (poll_ret == 0) {
+/**
+ * Wait for the ports in epoll and resume the jobs the handle of which is
+ * ready
+ */
+static int flash_jobs_wait_epoll(int epoll, struct epoll_event *ready, int count, int timeout,
+				 struct flash_job **pending, int *pending_count)
+{
+	struct flash_job *job;
+	int i, n;
+
+	n = epoll_wait(epoll, ready, count, timeout);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (i = 0; i < n; i++) {
+		job = ready[i].data.ptr;
+		if (job->result != CYRET_AGAIN)
 			continue;
-		} else if (poll_ret < 0) {
-			printf("Poll error: %s\n", strerror(errno));
-			return 1;
-		}
+		if (ready[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			CyBtldr_AsyncOnReadable(&job->op);
+		if (ready[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+			CyBtldr_AsyncOnWritable(&job->op);
+		flash_job_pend(job, pending, pending_count);
+	}
 
-		/* Ok, we read some data, start the stop timer */
-		clock_gettime(CLOCK_MONOTONIC, &tp);
-		start_milli = timespec_milliseconds(&tp);
+	return 0;
+}
 
-		read_bytes = read(g_serial_fd, &bytes[cur_byte++], 1);
-		if (read_bytes != 1) {
-			return 1;
-		}
+/**
+ * Submit the reads and writes queued by the ports, wait for completions and
+ * resume the jobs of the ports they belong to
+ */
+static int flash_jobs_wait_uring(struct uring *ring, int timeout,
+				 struct flash_job **pending, int *pending_count)
+{
+	struct io_uring_cqe *cqe;
+	struct serial_port *port;
+	int i, first = *pending_count, ret;
+
+	ret = uring_submit_and_wait(ring, timeout);
+	if (ret < 0 && ret != -ETIME && ret != -EINTR)
+		return ret;
+
+	while ((cqe = uring_peek_cqe(ring))) {
+		port = serial_uring_complete(cqe);
+		uring_cqe_seen(ring);
+		if (port)
+			flash_job_pend(container_of(port, struct flash_job, port), pending, pending_count);
+	}
+
+	/* The operation checks which of its read or write completed */
+	for (i = first; i < *pending_count; i++) {
+		CyBtldr_AsyncOnReadable(&pending[i]->op);
+		CyBtldr_AsyncOnWritable(&pending[i]->op);
 	}
-	dbg_printf("Read %d bytes\n", cur_byte);
-	for(i = 0; i < cur_byte; i++)
-		dbg_printf(" 0x%02x ", bytes[i]);
-	dbg_printf("\n");
 
-	return CYRET_SUCCESS;
+	return 0;
 }
 
-static int serial_write(unsigned char *bytes, int size)
+static void flash_jobs_interrupt(int sig)
 {
-	int i;
-	ssize_t write_bytes;
+	g_interrupted = 1;
+}
 
-	dbg_printf("Serial: writing %d bytes to bootloader\n", size);
-	for(i = 0; i< size; i++)
-		dbg_printf(" 0x%02x ", bytes[i]);
-	dbg_printf("\n");
-	write_bytes = write(g_serial_fd, bytes, size);
-	if (write_bytes != size) {
-		printf("Error when writing bytes\n");
-		return 1;
+/**
+ * Run the jobs of several ports from a single thread: each job is suspended
+ * while it waits for its port, and resumed when epoll reports the port ready
+ * or its deadline expires. With an io_uring, the ports queue their reads and
+ * writes on it instead, and all of them are submitted and waited for with a
+ * single system call. Only the jobs resumed are polled again, and deadlines
+ * are kept in a heap, so that a wakeup costs O(log N) for N ports.
+ */
+static void flash_jobs_run(struct flash_job *jobs, int count, struct uring *ring)
+{
+	struct flash_job **pending = calloc(count, sizeof(*pending));
+	struct epoll_event *ready = calloc(count, sizeof(*ready));
+	struct job_heap heap = { calloc(count, sizeof(*heap.jobs)), 0 };
+	struct sigaction interrupt = { .sa_handler = flash_jobs_interrupt }, prev_interrupt;
+	struct flash_job *job;
+	unsigned long long now;
+	unsigned char events;
+	int i, fd, ret, running = 0, pending_count = 0, timeout, job_timeout;
+	int epoll = -1;
+
+	if (!ring) {
+		epoll = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll < 0) {
+			printf("Epoll error: %s\n", strerror(errno));
+			for (i = 0; i < count; i++)
+				jobs[i].result = CYRET_ERR_COMM_MASK;
+			goto out;
+		}
+	}
+
+	/* Ctrl-C interrupts the wait for the ports instead of the process, so
+	 * that the running jobs are cancelled and their ports closed */
+	sigemptyset(&interrupt.sa_mask);
+	sigaction(SIGINT, &interrupt, &prev_interrupt);
+
+	for (i = 0; i < count; i++) {
+		job = &jobs[i];
+		job->start_us = now_us();
+		job->async = 1;
+		job->heap_index = -1;
+		job->epoll_fd = -1;
+		job->result = CyBtldr_AsyncRun(&job->op, &job->session, &job->async_comms,
+					       flash_job_async, job);
+		if (job->result == CYRET_SUCCESS) {
+			job->result = CYRET_AGAIN;
+			flash_job_pend(job, pending, &pending_count);
+			running++;
+		}
 	}
 
-	return CYRET_SUCCESS;
+	while (1) {
+		for (i = 0; i < pending_count; i++) {
+			job = pending[i];
+			job->pending = 0;
+			ret = CyBtldr_AsyncPollStatus(&job->op, &fd, &events, &job_timeout);
+			if (ret != CYRET_AGAIN) {
+				job->result = ret;
+				job->duration_us = now_us() - job->start_us;
+				flash_job_watch(epoll, job, -1, 0);
+				job_heap_remove(&heap, job);
+				running--;
+				continue;
+			}
+			flash_job_save_checkpoint(job);
+			flash_job_watch(epoll, job, fd, events);
+			if (job_timeout >= 0)
+				job_heap_set(&heap, job, CyBtldr_AsyncNow() + job_timeout);
+			else
+				job_heap_remove(&heap, job);
+		}
+		pending_count = 0;
+		if (!running)
+			break;
+
+		timeout = -1;
+		if (heap.count) {
+			now = CyBtldr_AsyncNow();
+			timeout = heap.jobs[0]->deadline > now ? (int)(heap.jobs[0]->deadline - now) : 0;
+		}
+		if (ring)
+			ret = flash_jobs_wait_uring(ring, timeout, pending, &pending_count);
+		else
+			ret = flash_jobs_wait_epoll(epoll, ready, count, timeout, pending, &pending_count);
+		if (ret < 0 || g_interrupted) {
+			if (ret < 0)
+				printf("%s error: %s\n", ring ? "io_uring" : "Epoll", strerror(-ret));
+			else
+				printf("Interrupted\n");
+			for (i = 0; i < count; i++) {
+				job = &jobs[i];
+				if (job->result != CYRET_AGAIN)
+					continue;
+				if (job->op.done) {
+					job->result = job->op.result;
+				} else {
+					CyBtldr_AsyncCancel(&job->op);
+					job->result = ret < 0 ? CYRET_ERR_COMM_MASK : CYRET_ABORT;
+				}
+				job->duration_us = now_us() - job->start_us;
+			}
+			break;
+		}
+
+		/* The deadline of a job resumed above may be stale, the operation
+		 * then ignores the timeout and the job is polled again anyway */
+		now = CyBtldr_AsyncNow();
+		while (heap.count && heap.jobs[0]->deadline <= now) {
+			job = heap.jobs[0];
+			job_heap_remove(&heap, job);
+			CyBtldr_AsyncOnTimeout(&job->op);
+			flash_job_pend(job, pending, &pending_count);
+		}
+	}
+
+	sigaction(SIGINT, &prev_interrupt, NULL);
+out:
+	if (epoll >= 0)
+		close(epoll);
+	free(heap.jobs);
+	free(ready);
+	free(pending);
 }
 
+static int has_glob_chars(const char *str)
+{
+	return strpbrk(str, "*?[") != NULL;
+}
 
-static CyBtldr_CommunicationsData serial_coms = {
-	.OpenConnection = serial_open,
-	.CloseConnection = serial_close,
-	.ReadData = serial_read,
-	.WriteData = serial_write,
-	.MaxTransferSize = 64,
-};
+/**
+ * Expand the serial port arguments, which can be glob patterns, to the
+ * list of serial ports to flash
+ */
+static int expand_serial_ports(char ***ports)
+{
+	glob_t globbuf;
+	unsigned int i;
+	int flags = 0, count = 0, ret;
 
+	memset(&globbuf, 0, sizeof(globbuf));
+	for (i = 0; i < args_info.serial_given; i++) {
+		/* An IPv6 address in brackets is not a pattern */
+		ret = glob(args_info.serial_arg[i], flags | (has_glob_chars(args_info.serial_arg[i]) &&
+			   !serial_is_tcp(args_info.serial_arg[i]) ? 0 : GLOB_NOCHECK), NULL, &globbuf);
+		if (ret == GLOB_NOMATCH) {
+			printf("No serial port matching %s\n", args_info.serial_arg[i]);
+			return -1;
+		} else if (ret != 0) {
+			printf("Failed to expand %s\n", args_info.serial_arg[i]);
+			return -1;
+		}
+		flags = GLOB_APPEND;
+	}
+
+	if (!args_info.serial_given) {
+		*ports = malloc(sizeof(char *));
+		(*ports)[0] = DEFAULT_SERIAL_PORT;
+		return 1;
+	}
 
-static void serial_progress_update(unsigned char arrayId, unsigned short rowNum)
+	*ports = malloc(globbuf.gl_pathc * sizeof(char *));
+	for (i = 0; i < globbuf.gl_pathc; i++)
+		(*ports)[count++] = strdup(globbuf.gl_pathv[i]);
+	globfree(&globbuf);
+
+	return count;
+}
+
+static const char *result_str(int result)
 {
-	printf("Progress: array_id %d, row_num %d\n", arrayId, rowNum);
+	if (result == CYRET_SUCCESS)
+		return "OK";
+	else if (result & CYRET_ERR_COMM_MASK)
+		return "communication error";
+	else if (result & CYRET_ERR_BTLDR_MASK)
+		return "bootloader error";
+	else if (result == CYRET_ERR_DEVICE)
+		return "wrong device";
+	else if (result == CYRET_ERR_CHECKSUM)
+		return "checksum mismatch";
+	else if (result == CYRET_ERR_FILE)
+		return "file error";
+	else if (result == CYRET_ABORT)
+		return "interrupted";
+	return "failed";
 }
 
 unsigned char sec_key[KEY_BYTES];
 
 int main(int argc, char **argv)
 {
-	int ret, action = PROGRAM;
-	const char *action_str = "programing";
-	unsigned char *key = NULL;
+	int i, ret, port_count, transfer_size, failed = 0;
+	struct timespec start, end;
+	struct rusage usage;
+	enum serial_parity parity = SERIAL_PARITY_NONE;
+	struct flash_job *jobs;
+	struct trace trace;
+	struct uring uring, *ring = NULL;
+	char **ports;
 
 	if (cyhostboot_cmdline_parser(argc, argv, &args_info) != 0) {
 		return EXIT_FAILURE;
 	}
 
 	if (args_info.erase_given) {
-		action = ERASE;
-		action_str = "erasing";
+		g_action = ERASE;
+		g_action_str = "erasing";
 	} else if (args_info.verify_given) {
-		action = VERIFY;
-		action_str = "verifying";
+		g_action = VERIFY;
+		g_action_str = "verifying";
 	}
 
-	if (action == PROGRAM)
+	if (g_action == PROGRAM)
 		printf("Programing file %s\n", args_info.file_arg);
 
 	if (args_info.key_given) {
@@ -217,16 +895,165 @@ int main(int argc, char **argv)
 			end++;
 			start = end;
 		}
-		key = sec_key;
+		g_key = sec_key;
 	}
 
-	printf("Start %s on serial %s, baudrate %d\n", action_str, args_info.serial_arg, args_info.baudrate_arg);
-	ret = CyBtldr_RunAction(action, args_info.file_arg, key, 1, &serial_coms, serial_progress_update);
-	if (ret != CYRET_SUCCESS) {
-		printf("%s failed: %d\n", action_str, ret);
+	if (args_info.odd_given)
+		parity = SERIAL_PARITY_ODD;
+	else if (args_info.even_given)
+		parity = SERIAL_PARITY_EVEN;
+
+	if (args_info.retries_arg < 0 || args_info.retries_arg > MAX_RETRIES ||
+	    args_info.retry_delay_arg < 0 || args_info.retry_delay_arg > CYBTLDR_MAX_RETRY_DELAY) {
+		printf("Invalid retries %d or retry delay %d\n", args_info.retries_arg, args_info.retry_delay_arg);
+		return 1;
+	}
+
+	if (strcmp(args_info.transfer_size_arg, "auto") == 0) {
+		transfer_size = 0;
+	} else {
+		transfer_size = atoi(args_info.transfer_size_arg);
+		if (transfer_size < MIN_TRANSFER_SIZE || transfer_size > MAX_COMMAND_SIZE) {
+			printf("Invalid transfer size %s\n", args_info.transfer_size_arg);
+			return 1;
+		}
+	}
+
+	if (args_info.resume_flag && args_info.then_given) {
+		printf("--resume can not be used with --then\n");
+		return 1;
+	}
+
+	/* Check the whole files before touching any device */
+	if (load_image(args_info.file_arg, &g_image))
+		return 1;
+	g_image_hash = image_hash(&g_image);
+
+	g_step_count = 1 + args_info.then_given;
+	g_steps = calloc(g_step_count, sizeof(*g_steps));
+	g_step_files = calloc(g_step_count, sizeof(*g_step_files));
+	g_steps[0].action = g_action;
+	g_steps[0].image = &g_image;
+	g_steps[0].appId = args_info.app_id_given ? args_info.app_id_arg : 1;
+	g_step_files[0] = args_info.file_arg;
+	for (i = 1; i < g_step_count; i++) {
+		if (parse_step(args_info.then_arg[i - 1], i))
+			return 1;
+		printf("Then %s file %s\n", action_str(g_steps[i].action), g_step_files[i]);
+	}
+	if (g_step_count > 1) {
+		/* The messages of the session cover all its steps */
+		char *str = steps_str();
+		if (str)
+			g_action_str = str;
+	}
+
+	port_count = expand_serial_ports(&ports);
+	if (port_count <= 0)
+		return 1;
+
+	if (args_info.trace_given && trace_open(&trace, args_info.trace_arg)) {
+		printf("Failed to create trace %s: %s\n", args_info.trace_arg, strerror(errno));
+		return 1;
+	}
+
+	/* Reports are written one at a time on the interrupt endpoint, not queued */
+	for (i = 0; i < port_count && args_info.io_uring_flag; i++) {
+		if (serial_is_hid(ports[i])) {
+			printf("io_uring is not used with HID ports, using epoll\n");
+			args_info.io_uring_flag = 0;
+		}
+	}
+	if (args_info.io_uring_flag) {
+		ret = uring_init(&uring, URING_ENTRIES_PER_PORT * port_count);
+		if (ret < 0)
+			printf("io_uring not available (%s), using epoll\n", strerror(-ret));
+		else
+			ring = &uring;
+	}
+
+	jobs = calloc(port_count, sizeof(*jobs));
+	for (i = 0; i < port_count; i++) {
+		serial_init(&jobs[i].port, ports[i], atoi(args_info.baudrate_arg), parity, args_info.timeout_arg);
+		serial_init_comms(&jobs[i].port, &jobs[i].comms);
+		jobs[i].comms.MaxTransferSize = transfer_size;
+		if (ring)
+			serial_init_uring_comms(&jobs[i].port, ring, &jobs[i].async_comms);
+		else
+			serial_init_async_comms(&jobs[i].port, &jobs[i].async_comms);
+		jobs[i].async_comms.MaxTransferSize = transfer_size;
+		if (jobs[i].port.hid && (!transfer_size || transfer_size > SERIAL_HID_REPORT_SIZE)) {
+			if (transfer_size)
+				printf("%s: transfer size limited to the %d byte HID reports\n", ports[i],
+				       SERIAL_HID_REPORT_SIZE);
+			jobs[i].comms.MaxTransferSize = SERIAL_HID_REPORT_SIZE;
+			jobs[i].async_comms.MaxTransferSize = SERIAL_HID_REPORT_SIZE;
+		}
+		jobs[i].port.low_latency = args_info.low_latency_flag;
+		if (args_info.trace_given) {
+			jobs[i].port.trace = &trace;
+			jobs[i].port.trace_id = i + 1;
+			trace_name_port(&trace, i + 1, ports[i]);
+		}
+		CyBtldr_InitSession(&jobs[i].session, &jobs[i].comms);
+		if (args_info.fast_flag)
+			jobs[i].session.flags |= CYBTLDR_FLAG_FAST_PROGRAM;
+		if (args_info.delta_flag)
+			jobs[i].session.flags |= CYBTLDR_FLAG_DELTA_PROGRAM;
+		if (args_info.if_changed_flag)
+			jobs[i].session.flags |= CYBTLDR_FLAG_SKIP_UP_TO_DATE;
+		jobs[i].session.retryCount = args_info.retries_arg;
+		jobs[i].session.retryDelay = args_info.retry_delay_arg;
+	}
+
+	if (port_count > 1)
+		printf("Start %s on %d serial ports\n", g_action_str, port_count);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (port_count > 1) {
+		/* Keep the reports of several boards readable */
+		g_progress_interval_us = GANG_PROGRESS_INTERVAL_US;
+	}
+	if (port_count == 1 && !ring)
+		flash_job_run(&jobs[0]);
+	else
+		flash_jobs_run(jobs, port_count, ring);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (ring)
+		uring_exit(ring);
+	getrusage(RUSAGE_SELF, &usage);
+
+	if (args_info.trace_given) {
+		trace_close(&trace);
+		printf("Trace written to %s\n", args_info.trace_arg);
+	}
+
+	if (port_count > 1) {
+		printf("\n%-32s %-10s %9s %8s  %s\n", "Port", "Baudrate", "Time", "Retries", "Result");
+		for (i = 0; i < port_count; i++) {
+			printf("%-32s %-10d %8.3fs %8u  %s (0x%x)\n", jobs[i].port.name, jobs[i].port.baudrate,
+			       jobs[i].duration_us / 1e6, jobs[i].session.retries,
+			       result_str(jobs[i].result), jobs[i].result);
+		}
+		printf("\n");
+	}
+
+	printf("Time: wall %.3fs, user %.3fs, sys %.3fs\n",
+	       (timespec_microseconds(&end) - timespec_microseconds(&start)) / 1e6,
+	       timeval_microseconds(&usage.ru_utime) / 1e6,
+	       timeval_microseconds(&usage.ru_stime) / 1e6);
+
+	for (i = 0; i < port_count; i++) {
+		if (jobs[i].result != CYRET_SUCCESS)
+			failed++;
+	}
+	if (failed) {
+		if (port_count == 1)
+			printf("%s failed: %d\n", g_action_str, jobs[0].result);
+		else
+			printf("%s failed on %d/%d port(s)\n", g_action_str, failed, port_count);
 		return 1;
 	}
-	printf("%s OK !\n", action_str);
+	printf("%s OK !\n", g_action_str);
 
 	return 0;
 }
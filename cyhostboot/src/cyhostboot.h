@@ -0,0 +1,37 @@
+#ifndef __CYHOSTBOOT_H__
+#define __CYHOSTBOOT_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/time.h>
+
+#ifdef DEBUG
+#define dbg_printf(fmt, args...)    printf(fmt, ## args)
+#else
+#define dbg_printf(fmt, args...)    /* Don't do anything in release builds */
+#endif
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* Minimum time between progress reports, in microseconds */
+#define PROGRESS_INTERVAL_US		200000
+#define GANG_PROGRESS_INTERVAL_US	1000000
+
+static inline unsigned long long timespec_milliseconds(struct timespec *a)
+{
+	return a->tv_sec*1000 + a->tv_nsec/1000000;
+}
+
+static inline unsigned long long timespec_microseconds(struct timespec *a)
+{
+	return a->tv_sec*1000000ULL + a->tv_nsec/1000;
+}
+
+static inline unsigned long long timeval_microseconds(struct timeval *a)
+{
+	return a->tv_sec*1000000ULL + a->tv_usec;
+}
+
+#endif
@@ -0,0 +1,851 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <cybtldr_command.h>
+
+#include "cyhostboot.h"
+#include "serial.h"
+#include "serial_baudrate.h"
+#include "serial_hid.h"
+#include "serial_latency.h"
+#include "serial_tcp.h"
+
+/* Maximum baudrate deviation accepted, as a fraction (1/50 = 2%) */
+#define BAUDRATE_TOLERANCE	50
+
+/* The io_uring user data of a port is its address, tagged with the request
+ * (and the packet slot of a write) */
+#define URING_READ		0
+#define URING_OTHER		1
+#define URING_WRITE		2
+#define URING_TAG_MASK		3
+
+static unsigned int rx_ring_count(struct serial_port *port)
+{
+	return port->rx.tail - port->rx.head;
+}
+
+static unsigned char rx_ring_peek(struct serial_port *port, unsigned int offset)
+{
+	return port->rx.buf[(port->rx.head + offset) % SERIAL_RX_RING_SIZE];
+}
+
+static void rx_ring_received(struct serial_port *port, unsigned int count)
+{
+	port->rx.tail += count;
+	port->rx_bytes += count;
+
+	if (port->trace && count && port->transfer.write_start && !port->transfer.first_byte)
+		port->transfer.first_byte = trace_now();
+}
+
+/* A response frame comes in as many input reports as needed, the padding of
+ * its last report is dropped */
+static int rx_ring_fill_report(struct serial_port *port)
+{
+	unsigned char report[SERIAL_HID_REPORT_SIZE];
+	unsigned int count, i;
+	int size;
+
+	size = serial_hid_read_report(port, report);
+	if (size <= 0)
+		return size;
+
+	if (!port->hid_frame_left) {
+		/* Not the start of a frame, a late part of a dropped one */
+		if (size < 4 || report[0] != CMD_START)
+			return 0;
+		port->hid_frame_left = BASE_CMD_SIZE + (report[2] | (report[3] << 8));
+	}
+	count = size;
+	if (count > (unsigned int)port->hid_frame_left)
+		count = port->hid_frame_left;
+	if (count > SERIAL_RX_RING_SIZE - rx_ring_count(port))
+		count = SERIAL_RX_RING_SIZE - rx_ring_count(port);
+
+	for (i = 0; i < count; i++)
+		port->rx.buf[(port->rx.tail + i) % SERIAL_RX_RING_SIZE] = report[i];
+	port->hid_frame_left -= count;
+	rx_ring_received(port, count);
+
+	return count;
+}
+
+static int rx_ring_fill(struct serial_port *port)
+{
+	unsigned int tail = port->rx.tail % SERIAL_RX_RING_SIZE;
+	unsigned int len = SERIAL_RX_RING_SIZE - rx_ring_count(port);
+	ssize_t read_bytes;
+
+	if (port->hid)
+		return rx_ring_fill_report(port);
+
+	/* Only read up to the end of the buffer, the next call will wrap */
+	if (len > SERIAL_RX_RING_SIZE - tail)
+		len = SERIAL_RX_RING_SIZE - tail;
+
+	read_bytes = read(port->fd, &port->rx.buf[tail], len);
+	if (read_bytes < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		printf("Read error: %s\n", strerror(errno));
+		return -1;
+	} else if (read_bytes == 0 && port->tcp) {
+		printf("Connection closed by the server\n");
+		return -1;
+	}
+	rx_ring_received(port, read_bytes);
+
+	return read_bytes;
+}
+
+static void serial_trace_end(struct serial_port *port)
+{
+	if (port->trace && port->transfer.write_start)
+		trace_transfer_end(port->trace, port->trace_id, &port->transfer);
+}
+
+static unsigned long long uring_user_data(struct serial_port *port, int tag)
+{
+	return (uintptr_t)port | tag;
+}
+
+/* Return the last entry queued if it is a write of the port not submitted yet */
+static struct io_uring_sqe *serial_uring_last_write(struct serial_port *port)
+{
+	struct io_uring_sqe *sqe = uring_last_sqe(port->uring);
+
+	if (sqe && (sqe->opcode == IORING_OP_WRITE || sqe->opcode == IORING_OP_SEND) &&
+	    (sqe->user_data & ~(unsigned long long)URING_TAG_MASK) == (uintptr_t)port)
+		return sqe;
+
+	return NULL;
+}
+
+/**
+ * Queue a read into the free part of the receive ring up to its end, linked
+ * to a timeout which cancels it if nothing is received in time
+ */
+static int serial_uring_queue_read(struct serial_port *port)
+{
+	unsigned int tail = port->rx.tail % SERIAL_RX_RING_SIZE;
+	unsigned int len = SERIAL_RX_RING_SIZE - rx_ring_count(port);
+	struct io_uring_sqe *sqe;
+
+	if (len > SERIAL_RX_RING_SIZE - tail)
+		len = SERIAL_RX_RING_SIZE - tail;
+
+	/* Only start reading once the packet is written */
+	sqe = serial_uring_last_write(port);
+	port->rx_link_seq = 0;
+	if (sqe) {
+		sqe->flags |= IOSQE_IO_LINK;
+		port->rx_link_seq = port->tx_slots[port->tx_slot].seq;
+	}
+
+	sqe = uring_get_sqe(port->uring);
+	if (!sqe)
+		goto err;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = port->fd;
+	sqe->addr = (uintptr_t)&port->rx.buf[tail];
+	sqe->len = len;
+	sqe->off = -1;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = uring_user_data(port, URING_READ);
+	port->rx_queued = 1;
+
+	sqe = uring_get_sqe(port->uring);
+	if (!sqe)
+		goto err;
+	port->rx_timeout.tv_sec = port->timeout / 1000;
+	port->rx_timeout.tv_nsec = (port->timeout % 1000) * 1000000LL;
+	sqe->opcode = IORING_OP_LINK_TIMEOUT;
+	sqe->addr = (uintptr_t)&port->rx_timeout;
+	sqe->len = 1;
+	sqe->user_data = uring_user_data(port, URING_OTHER);
+
+	return 0;
+
+err:
+	printf("Failed to queue a read on io_uring\n");
+	return 1;
+}
+
+/* Only a failed or short write completes with a completion queue entry, or
+ * any write when tracing, to record when it ended */
+static int serial_uring_queue_write(struct serial_port *port, int slot)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe(port->uring);
+	if (!sqe) {
+		printf("Failed to queue a write on io_uring\n");
+		return 1;
+	}
+	sqe->fd = port->fd;
+	sqe->addr = (uintptr_t)&port->tx_slots[slot].buf[port->tx_slots[slot].written];
+	sqe->len = port->tx_slots[slot].size - port->tx_slots[slot].written;
+	if (port->tcp) {
+		/* The offset field holds the destination address of a send */
+		sqe->opcode = IORING_OP_SEND;
+		sqe->msg_flags = MSG_NOSIGNAL;
+	} else {
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->off = -1;
+	}
+	sqe->flags = port->trace ? 0 : IOSQE_CQE_SKIP_SUCCESS;
+	sqe->user_data = uring_user_data(port, URING_WRITE + slot);
+	/* 0 stands for no write */
+	if (!++port->tx_seq)
+		port->tx_seq++;
+	port->tx_slots[slot].seq = port->tx_seq;
+
+	return 0;
+}
+
+/* The read of a closed port completes with -ECANCELED */
+static void serial_uring_cancel_read(struct serial_port *port)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe(port->uring);
+	if (!sqe)
+		return;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = uring_user_data(port, URING_READ);
+	sqe->user_data = uring_user_data(port, URING_OTHER);
+}
+
+/**
+ * Return the termios constant for standard baudrates, or B0 if the
+ * baudrate must be set using termios2
+ */
+static speed_t get_serial_speed(int baudrate)
+{
+	switch (baudrate) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 500000: return B500000;
+		case 576000: return B576000;
+		case 921600: return B921600;
+		case 1000000: return B1000000;
+		case 1152000: return B1152000;
+		case 1500000: return B1500000;
+		case 2000000: return B2000000;
+		case 2500000: return B2500000;
+		case 3000000: return B3000000;
+		case 3500000: return B3500000;
+		case 4000000: return B4000000;
+		default: return B0;
+	};
+}
+
+/**
+ * Check the baudrate accepted by the driver is close enough to the requested
+ * one for the UART to sample correctly
+ */
+static int serial_check_baudrate(struct serial_port *port)
+{
+	int baudrate = port->baudrate;
+	int actual;
+
+	if (serial_get_baudrate(port->fd, &actual))
+		return 1;
+
+	if (actual != baudrate)
+		printf("Requested baudrate %d, driver set %d\n", baudrate, actual);
+
+	if (abs(actual - baudrate) > baudrate / BAUDRATE_TOLERANCE) {
+		printf("Baudrate %d is not supported by the serial port\n", baudrate);
+		return 1;
+	}
+
+	return 0;
+}
+
+int serial_open(void *ctx)
+{
+	struct serial_port *port = ctx;
+	speed_t baudrate;
+
+	/* A read still queued on io_uring completes at the tail of the ring,
+	 * drop the bytes received without moving it */
+	port->rx.head = port->rx.tail;
+	port->tx_busy = 0;
+	port->uring_error = 0;
+	port->hid_frame_left = 0;
+	port->opens++;
+
+	/* The line is set up by the server */
+	if (port->tcp)
+		return serial_tcp_connect(port) ? 1 : CYRET_SUCCESS;
+	if (port->hid)
+		return serial_hid_open(port) ? 1 : CYRET_SUCCESS;
+
+	if (port->baudrate <= 0) {
+		printf("Invalid baudrate %d\n", port->baudrate);
+		return 1;
+	}
+	baudrate = get_serial_speed(port->baudrate);
+
+	port->fd = open(port->name, O_RDWR | O_NONBLOCK);
+	if (port->fd < 0) {
+		printf("Failed to open serial: %s\n", strerror(errno));
+		return 1;
+	}
+	// setting default baud rate and attributes
+	struct termios port_settings;
+	memset (&port_settings, 0, sizeof(port_settings));
+	/* B0 would hang up the line, use a placeholder until termios2 sets the real one */
+	cfsetispeed (&port_settings, baudrate != B0 ? baudrate : B115200);
+	cfsetospeed (&port_settings, baudrate != B0 ? baudrate : B115200);
+	if (port->parity == SERIAL_PARITY_ODD) {
+		printf ("odd parity\n");
+		port_settings.c_cflag |= PARENB; // enable parity
+		port_settings.c_cflag |= PARODD; // enable odd parity => enable odd parity
+	} else if (port->parity == SERIAL_PARITY_EVEN) {
+		printf ( "even parity\n");
+		port_settings.c_cflag |= PARENB; // enable parity
+		port_settings.c_cflag &= ~PARODD; // disable odd parity => enable even parity
+	} else {
+		printf ("no parity\n");
+		port_settings.c_cflag &= ~PARENB; // disable parity
+	}
+	port_settings.c_cflag &= ~CSTOPB; // disable extra stop bit => one stop bit
+	port_settings.c_cflag |= CS8; // 8 bits per byte
+	port_settings.c_cflag &= ~CRTSCTS; // Disable RTS/CTS hardware flow control
+	port_settings.c_cflag |= CREAD | CLOCAL; // turn on read and disable ctrl lines
+	port_settings.c_lflag &= ~ICANON; // disable canonical mode
+	port_settings.c_lflag &= ~(ECHO | ECHOE | ECHONL); // disable any kind of echo
+	port_settings.c_lflag &= ~ISIG; // disable interruption of INTR, QUIT and SUSP
+	port_settings.c_iflag &= ~(IXON | IXOFF | IXANY); // turn off sw flow control
+	port_settings.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL); // Disable any special handling of received bytes
+	port_settings.c_oflag &= ~(OPOST); // Prevent special interpretation of output bytes (e.g. newline chars)
+	port_settings.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
+	port_settings.c_cc[VTIME] = 0; // do not wait, return immediately
+	port_settings.c_cc[VMIN] = 0; // return as soon as some data
+	if (tcsetattr(port->fd, TCSAFLUSH, &port_settings) != 0) {
+		printf ("Error %i from tcsetattr: %s\n", errno, strerror(errno));
+		goto err;
+	}
+
+	/* Non standard baudrates can only be set through termios2 */
+	if (baudrate == B0 && serial_set_custom_baudrate(port->fd, port->baudrate))
+		goto err;
+
+	if (serial_check_baudrate(port))
+		goto err;
+
+	port->vmin = 0;
+	/* With VMIN 0 a read queued on io_uring would complete at once without
+	 * data instead of waiting for it */
+	if (port->uring)
+		serial_set_vmin(port, 1);
+	if (port->low_latency)
+		serial_set_low_latency(port);
+
+	return CYRET_SUCCESS;
+
+err:
+	/* The connection is not closed when it fails to open */
+	close(port->fd);
+	port->fd = -1;
+	return 1;
+}
+
+int serial_close(void *ctx)
+{
+	struct serial_port *port = ctx;
+
+	dbg_printf("Closing serial\n");
+	/* The last command (exit bootloader) has no response */
+	serial_trace_end(port);
+	if (port->low_latency && serial_is_tty(port))
+		serial_restore_latency(port);
+	if (port->uring && port->rx_queued)
+		serial_uring_cancel_read(port);
+	/* The last packet may still be queued, it must be submitted while its
+	 * file descriptor is valid */
+	if (port->uring)
+		uring_submit(port->uring);
+	close(port->fd);
+	port->fd = -1;
+
+	return CYRET_SUCCESS;
+}
+
+/* Size of the frame at the head of the receive ring, once its header is in */
+static int rx_frame_size(struct serial_port *port)
+{
+	if (rx_ring_count(port) < 4)
+		return BASE_CMD_SIZE;
+
+	return BASE_CMD_SIZE + (rx_ring_peek(port, 2) | (rx_ring_peek(port, 3) << 8));
+}
+
+/**
+ * Take a single response frame from the receive ring.
+ * A frame is [SOP] [status] [size (2 bytes)] [data] [checksum (2 bytes)] [EOP],
+ * so we know the exact number of bytes to wait for once the header is in and
+ * can return as soon as the frame is complete instead of waiting for silence.
+ * Return CYRET_AGAIN if the frame is not complete yet.
+ */
+static int serial_take_frame(struct serial_port *port, unsigned char *bytes, int size)
+{
+	int frame_size, i;
+
+	/* Drop any garbage received before the start of packet */
+	while (rx_ring_count(port) && rx_ring_peek(port, 0) != CMD_START)
+		port->rx.head++;
+
+	frame_size = rx_frame_size(port);
+	if (frame_size > size) {
+		printf("Response frame too large (%d > %d bytes)\n", frame_size, size);
+		return 1;
+	}
+	if (rx_ring_count(port) < frame_size) {
+		/* Sleep until the rest of the frame, or at least of its header, is in */
+		if (port->low_latency && serial_is_tty(port))
+			serial_set_vmin(port, frame_size - rx_ring_count(port));
+		return CYRET_AGAIN;
+	}
+
+	for (i = 0; i < frame_size; i++)
+		bytes[i] = rx_ring_peek(port, i);
+	port->rx.head += frame_size;
+
+	if (bytes[frame_size - 1] != CMD_STOP) {
+		printf("Invalid end of packet 0x%02x\n", bytes[frame_size - 1]);
+		return 1;
+	}
+
+	dbg_printf("Read %d bytes\n", frame_size);
+	for(i = 0; i < frame_size; i++)
+		dbg_printf(" 0x%02x ", bytes[i]);
+	dbg_printf("\n");
+
+	return CYRET_SUCCESS;
+}
+
+static void serial_read_done(struct serial_port *port, unsigned char *bytes, int ret)
+{
+	if (ret != CYRET_SUCCESS)
+		port->rx_stale = 1;
+	if (port->trace && port->transfer.write_start) {
+		if (ret == CYRET_SUCCESS) {
+			port->transfer.last_byte = trace_now();
+			port->transfer.read = BASE_CMD_SIZE + (bytes[2] | (bytes[3] << 8));
+		} else {
+			port->transfer.failed = 1;
+		}
+		serial_trace_end(port);
+	}
+}
+
+int serial_read_nonblock(void *ctx, unsigned char *bytes, int size)
+{
+	struct serial_port *port = ctx;
+	int ret;
+
+	ret = serial_take_frame(port, bytes, size);
+	if (ret == CYRET_AGAIN)
+		ret = rx_ring_fill(port) < 0 ? 1 : serial_take_frame(port, bytes, size);
+	if (ret != CYRET_AGAIN)
+		serial_read_done(port, bytes, ret);
+
+	return ret;
+}
+
+/**
+ * Read a single response frame from the bootloader. The process sleeps in
+ * poll() until data arrives or the deadline expires.
+ */
+int serial_read(void *ctx, unsigned char *bytes, int size)
+{
+	struct serial_port *port = ctx;
+	struct timespec tp;
+	unsigned long long deadline_milli, cur_milli;
+	struct pollfd fds[1];
+	int poll_ret, ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	deadline_milli = timespec_milliseconds(&tp) + port->timeout;
+
+	while ((ret = serial_read_nonblock(port, bytes, size)) == CYRET_AGAIN) {
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		cur_milli = timespec_milliseconds(&tp);
+		if (cur_milli >= deadline_milli)
+			return serial_timeout(port);
+
+		fds[0].revents = 0;
+		fds[0].events = POLLIN | POLLPRI;
+		fds[0].fd = port->fd;
+
+		poll_ret = poll(fds, 1, deadline_milli - cur_milli);
+		if (poll_ret < 0 && errno != EINTR) {
+			printf("Poll error: %s\n", strerror(errno));
+			break;
+		} else if (poll_ret > 0 && fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			printf("Serial port hung up\n");
+			break;
+		}
+	}
+	if (ret == CYRET_AGAIN) {
+		ret = 1;
+		serial_read_done(port, bytes, ret);
+	}
+
+	return ret;
+}
+
+static void serial_write_done(struct serial_port *port, int ret)
+{
+	port->tx_busy = 0;
+	if (ret == CYRET_SUCCESS) {
+		port->tx_bytes += port->tx_written;
+		/* A write queued on io_uring ends with its completion */
+		if (port->trace && !port->uring)
+			port->transfer.write_end = trace_now();
+	} else {
+		port->transfer.failed = 1;
+		serial_trace_end(port);
+	}
+}
+
+static void serial_write_start(struct serial_port *port, unsigned char *bytes, int size)
+{
+	int i;
+
+	/* Anything received before a command is a late response to a previous
+	 * one, which must not be taken for the response of this one */
+	if (rx_ring_count(port) || port->rx_stale) {
+		port->rx.head = port->rx.tail;
+		port->hid_frame_left = 0;
+		if (port->tcp)
+			serial_tcp_flush(port);
+		else if (port->hid)
+			serial_hid_flush(port);
+		else
+			tcflush(port->fd, TCIFLUSH);
+		port->rx_stale = 0;
+	}
+
+	if (port->trace) {
+		/* The previous command had no response (sync) */
+		serial_trace_end(port);
+		trace_transfer_start(&port->transfer, bytes, size);
+	}
+
+	dbg_printf("Serial: writing %d bytes to bootloader\n", size);
+	for(i = 0; i< size; i++)
+		dbg_printf(" 0x%02x ", bytes[i]);
+	dbg_printf("\n");
+
+	port->tx_busy = 1;
+	port->tx_written = 0;
+}
+
+int serial_write_nonblock(void *ctx, unsigned char *bytes, int size)
+{
+	struct serial_port *port = ctx;
+	ssize_t write_bytes;
+	int ret;
+
+	if (!port->tx_busy)
+		serial_write_start(port, bytes, size);
+
+	if (port->hid) {
+		ret = serial_hid_write(port, bytes, size);
+		if (ret == CYRET_AGAIN)
+			return ret;
+		port->tx_written = ret == CYRET_SUCCESS ? size : 0;
+		serial_write_done(port, ret);
+		return ret;
+	}
+
+	while (port->tx_written < size) {
+		/* A packet is sent at once, in a single segment over TCP */
+		if (port->tcp)
+			write_bytes = send(port->fd, bytes + port->tx_written, size - port->tx_written, MSG_NOSIGNAL);
+		else
+			write_bytes = write(port->fd, bytes + port->tx_written, size - port->tx_written);
+		if (write_bytes < 0 && errno == EINTR) {
+			continue;
+		} else if (write_bytes < 0 && errno == EAGAIN) {
+			/* Output buffer is full, wait for the driver to drain it */
+			return CYRET_AGAIN;
+		} else if (write_bytes < 0) {
+			printf("Error when writing bytes: %s\n", strerror(errno));
+			serial_write_done(port, 1);
+			return 1;
+		}
+		port->tx_written += write_bytes;
+	}
+	serial_write_done(port, CYRET_SUCCESS);
+
+	return CYRET_SUCCESS;
+}
+
+int serial_write(void *ctx, unsigned char *bytes, int size)
+{
+	struct serial_port *port = ctx;
+	struct pollfd fds[1];
+	struct timespec tp;
+	unsigned long long deadline_milli, cur_milli;
+	int ret, poll_ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	deadline_milli = timespec_milliseconds(&tp) + port->timeout;
+
+	while ((ret = serial_write_nonblock(port, bytes, size)) == CYRET_AGAIN) {
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		cur_milli = timespec_milliseconds(&tp);
+		if (cur_milli >= deadline_milli)
+			return serial_timeout(port);
+
+		fds[0].revents = 0;
+		fds[0].events = POLLOUT;
+		fds[0].fd = port->fd;
+
+		poll_ret = poll(fds, 1, deadline_milli - cur_milli);
+		if (poll_ret < 0 && errno != EINTR) {
+			printf("Poll error: %s\n", strerror(errno));
+			break;
+		} else if (poll_ret > 0 && fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			printf("Serial port hung up\n");
+			break;
+		}
+	}
+	if (ret == CYRET_AGAIN) {
+		ret = 1;
+		serial_write_done(port, ret);
+	}
+
+	return ret;
+}
+
+int serial_timeout(void *ctx)
+{
+	struct serial_port *port = ctx;
+
+	if (port->tx_busy) {
+		printf("Timeout when writing bytes\n");
+		serial_write_done(port, 1);
+	} else {
+		printf("Timeout waiting for response (%d/%d bytes)\n", rx_ring_count(port), rx_frame_size(port));
+		serial_read_done(port, NULL, 1);
+	}
+
+	return 1;
+}
+
+int serial_get_fd(void *ctx)
+{
+	struct serial_port *port = ctx;
+
+	return port->fd;
+}
+
+int serial_get_timeout(void *ctx)
+{
+	struct serial_port *port = ctx;
+
+	return port->timeout;
+}
+
+static int serial_uring_read(void *ctx, unsigned char *bytes, int size)
+{
+	struct serial_port *port = ctx;
+	int ret;
+
+	if (port->uring_error) {
+		port->uring_error = 0;
+		ret = 1;
+	} else {
+		ret = serial_take_frame(port, bytes, size);
+	}
+	if (ret == CYRET_AGAIN && !port->rx_queued && serial_uring_queue_read(port))
+		ret = 1;
+	if (ret != CYRET_AGAIN)
+		serial_read_done(port, bytes, ret);
+
+	return ret;
+}
+
+/**
+ * The packet is only queued, the response is read without waiting for the
+ * write to complete
+ */
+static int serial_uring_write(void *ctx, unsigned char *bytes, int size)
+{
+	struct serial_port *port = ctx;
+	struct io_uring_sqe *sqe;
+	int slot = port->tx_slot;
+
+	if (port->uring_error) {
+		port->uring_error = 0;
+		return 1;
+	}
+	if (size > MAX_COMMAND_SIZE) {
+		printf("Packet too large (%d bytes)\n", size);
+		return 1;
+	}
+
+	serial_write_start(port, bytes, size);
+	sqe = serial_uring_last_write(port);
+	if (sqe && port->tx_slots[slot].size + size <= (int)sizeof(port->tx_slots[slot].buf)) {
+		/* The previous packet (a sync) is not submitted yet, write both at once */
+		memcpy(&port->tx_slots[slot].buf[port->tx_slots[slot].size], bytes, size);
+		port->tx_slots[slot].size += size;
+		sqe->len += size;
+	} else {
+		/* The previous packet may still be written from the other slot */
+		slot = port->tx_slot = !slot;
+		memcpy(port->tx_slots[slot].buf, bytes, size);
+		port->tx_slots[slot].size = size;
+		port->tx_slots[slot].written = 0;
+		if (serial_uring_queue_write(port, slot)) {
+			serial_write_done(port, 1);
+			return 1;
+		}
+	}
+	port->tx_written = size;
+	serial_write_done(port, CYRET_SUCCESS);
+
+	return CYRET_SUCCESS;
+}
+
+static void serial_uring_read_complete(struct serial_port *port, int res)
+{
+	/* A canceled read timed out, was queued by a port since closed or
+	 * followed a write that failed */
+	port->rx_queued = 0;
+	port->rx_link_seq = 0;
+	if (res > 0) {
+		rx_ring_received(port, res);
+	} else if (res == 0) {
+		printf(port->tcp ? "Connection closed by the server\n" : "Serial port hung up\n");
+		port->uring_error = 1;
+	} else if (res != -ECANCELED && res != -EINTR && res != -EAGAIN) {
+		printf("Read error: %s\n", strerror(-res));
+		port->uring_error = 1;
+	}
+}
+
+static void serial_uring_write_complete(struct serial_port *port, int slot, int res)
+{
+	if (res == -EINTR || res == -EAGAIN)
+		res = 0;
+
+	/* The read linked to a failed or short write is canceled without a
+	 * completion of its own, the one of a complete write is only seen when
+	 * tracing */
+	if ((res < 0 || port->tx_slots[slot].written + res < port->tx_slots[slot].size) &&
+	    port->rx_queued && port->rx_link_seq == port->tx_slots[slot].seq) {
+		port->rx_queued = 0;
+		port->rx_link_seq = 0;
+	}
+
+	if (res < 0) {
+		printf("Error when writing bytes: %s\n", strerror(-res));
+		port->uring_error = 1;
+		return;
+	}
+
+	/* The rest of the packet is sent before the read is queued again */
+	port->tx_slots[slot].written += res;
+	if (port->tx_slots[slot].written < port->tx_slots[slot].size) {
+		if (serial_uring_queue_write(port, slot))
+			port->uring_error = 1;
+	} else if (port->trace && slot == port->tx_slot && port->transfer.write_start &&
+		   !port->transfer.write_end) {
+		port->transfer.write_end = trace_now();
+	}
+}
+
+struct serial_port *serial_uring_complete(const struct io_uring_cqe *cqe)
+{
+	struct serial_port *port;
+
+	port = (struct serial_port *)(uintptr_t)(cqe->user_data & ~(unsigned long long)URING_TAG_MASK);
+
+	switch (cqe->user_data & URING_TAG_MASK) {
+	case URING_READ:
+		serial_uring_read_complete(port, cqe->res);
+		break;
+	case URING_WRITE:
+	case URING_WRITE + 1:
+		serial_uring_write_complete(port, (cqe->user_data & URING_TAG_MASK) - URING_WRITE, cqe->res);
+		break;
+	default:
+		return NULL;
+	}
+
+	return port;
+}
+
+void serial_init(struct serial_port *port, const char *name, int baudrate,
+		 enum serial_parity parity, int timeout)
+{
+	memset(port, 0, sizeof(*port));
+	port->name = name;
+	port->baudrate = baudrate;
+	port->parity = parity;
+	port->timeout = timeout;
+	port->fd = -1;
+	port->tcp = serial_is_tcp(name);
+	port->hid = serial_is_hid(name);
+}
+
+int serial_is_tty(struct serial_port *port)
+{
+	return !port->tcp && !port->hid;
+}
+
+void serial_init_comms(struct serial_port *port, CyBtldr_CommunicationsData *comms)
+{
+	comms->OpenConnection = serial_open;
+	comms->CloseConnection = serial_close;
+	comms->ReadData = serial_read;
+	comms->WriteData = serial_write;
+	comms->Delay = NULL;
+	comms->MaxTransferSize = SERIAL_TRANSFER_SIZE;
+	comms->Context = port;
+}
+
+void serial_init_async_comms(struct serial_port *port, CyBtldr_AsyncCommunications *comms)
+{
+	comms->OpenConnection = serial_open;
+	comms->CloseConnection = serial_close;
+	comms->ReadData = serial_read_nonblock;
+	comms->WriteData = serial_write_nonblock;
+	comms->TimedOut = serial_timeout;
+	comms->GetHandle = serial_get_fd;
+	comms->GetTimeout = serial_get_timeout;
+	comms->MaxTransferSize = SERIAL_TRANSFER_SIZE;
+	comms->Context = port;
+}
+
+void serial_init_uring_comms(struct serial_port *port, struct uring *ring,
+			     CyBtldr_AsyncCommunications *comms)
+{
+	serial_init_async_comms(port, comms);
+	comms->ReadData = serial_uring_read;
+	comms->WriteData = serial_uring_write;
+	port->uring = ring;
+}
@@ -0,0 +1,152 @@
+#ifndef __SERIAL_H__
+#define __SERIAL_H__
+
+#include <cybtldr_async.h>
+#include <cybtldr_command.h>
+
+#include "trace.h"
+#include "uring.h"
+
+/* Size of the receive ring buffer, must be a power of 2 */
+#define SERIAL_RX_RING_SIZE	1024
+/* Maximum size of a packet sent to the bootloader */
+#define SERIAL_TRANSFER_SIZE	64
+
+enum serial_parity {
+	SERIAL_PARITY_NONE,
+	SERIAL_PARITY_EVEN,
+	SERIAL_PARITY_ODD,
+};
+
+/**
+ * A serial port connected to a bootloader. It is passed as context to the
+ * communication callbacks so that several ports can be used at once.
+ */
+struct serial_port {
+	const char *name;
+	int baudrate;
+	enum serial_parity parity;
+	/* Response timeout in milliseconds */
+	int timeout;
+	int fd;
+	/* Number of times the port was opened, which tells an event loop that
+	 * its handle changed even if the number of the new one is the same */
+	unsigned int opens;
+	/* Set when the port is reached over TCP (see serial_tcp.h) */
+	int tcp;
+	/**
+	 * Set when the port is a USB HID bootloader (see serial_hid.h), with
+	 * the bytes of the response frame still to come in the next reports
+	 */
+	int hid;
+	int hid_frame_left;
+	/**
+	 * Receive ring buffer: bytes are read in bulk from the serial port
+	 * and response frames are then extracted from it.
+	 */
+	struct {
+		unsigned char buf[SERIAL_RX_RING_SIZE];
+		unsigned int head;
+		unsigned int tail;
+	} rx;
+	/* Set when a response was not read, it may still come in */
+	int rx_stale;
+	/* Set while a packet is being written, with the bytes written so far */
+	int tx_busy;
+	int tx_written;
+	/* Reduce the latency of the driver and adapter (see serial_latency.h) */
+	int low_latency;
+	/* Settings changed by the low latency mode, restored on close */
+	int async_low_latency_set;
+	int saved_latency_timer;
+	int latency_reported;
+	/* Bytes the reader waits for before being woken up (termios VMIN) */
+	int vmin;
+	/**
+	 * io_uring the port is driven through instead of non-blocking calls
+	 * (see serial_init_uring_comms), with the read queued and the number
+	 * of the write it is linked to (0 for none). Packets are copied as
+	 * they are only queued, a sync and the packet sent again after it are
+	 * written at once.
+	 */
+	struct uring *uring;
+	int rx_queued;
+	unsigned int rx_link_seq;
+	struct {
+		unsigned char buf[2 * MAX_COMMAND_SIZE];
+		int size;
+		int written;
+		unsigned int seq;
+	} tx_slots[2];
+	int tx_slot;
+	unsigned int tx_seq;
+	struct __kernel_timespec rx_timeout;
+	/* Set when a queued read or write failed, reported by the next call */
+	int uring_error;
+	/* Bytes written to and read from the port since it was initialized */
+	unsigned long tx_bytes;
+	unsigned long rx_bytes;
+	/* Optional trace of the commands, the port is shown as trace_id */
+	struct trace *trace;
+	int trace_id;
+	/* Command being traced, until its response is read */
+	struct trace_transfer transfer;
+};
+
+void serial_init(struct serial_port *port, const char *name, int baudrate,
+		 enum serial_parity parity, int timeout);
+
+/**
+ * Return whether the port is a local tty, the line settings of which are set
+ * by the host
+ */
+int serial_is_tty(struct serial_port *port);
+
+/**
+ * Fill the bootloader communication struct to use the given port
+ */
+void serial_init_comms(struct serial_port *port, CyBtldr_CommunicationsData *comms);
+
+/**
+ * Fill the non-blocking communication struct to use the given port
+ */
+void serial_init_async_comms(struct serial_port *port, CyBtldr_AsyncCommunications *comms);
+
+/**
+ * Fill the non-blocking communication struct to use the given port through
+ * io_uring. A packet is queued on the ring and its write only completes
+ * silently, followed by the read of the response: the read only starts once
+ * the packet is written, and is linked to a timeout so that it does not stay
+ * queued after the response timeout. Reads return CYRET_AGAIN until
+ * serial_uring_complete() handled their completion.
+ */
+void serial_init_uring_comms(struct serial_port *port, struct uring *ring,
+			     CyBtldr_AsyncCommunications *comms);
+
+/**
+ * Handle a completion of a read or write queued by a port, return the port
+ * or NULL for the completions of the timeouts and cancellations that only
+ * need to be consumed
+ */
+struct serial_port *serial_uring_complete(const struct io_uring_cqe *cqe);
+
+int serial_open(void *ctx);
+int serial_close(void *ctx);
+int serial_read(void *ctx, unsigned char *bytes, int size);
+int serial_write(void *ctx, unsigned char *bytes, int size);
+
+/**
+ * Read a response or write a packet without blocking, CYRET_AGAIN is returned
+ * until it is complete
+ */
+int serial_read_nonblock(void *ctx, unsigned char *bytes, int size);
+int serial_write_nonblock(void *ctx, unsigned char *bytes, int size);
+
+/**
+ * Report the read or write in progress as timed out
+ */
+int serial_timeout(void *ctx);
+int serial_get_fd(void *ctx);
+int serial_get_timeout(void *ctx);
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ * termios2 helpers, kept in their own file since <asm/termbits.h> can not
+ * be included along with the libc <termios.h>.
+ */
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+
+#include "serial_baudrate.h"
+
+int serial_set_custom_baudrate(int fd, int baudrate)
+{
+	struct termios2 tio;
+
+	if (ioctl(fd, TCGETS2, &tio) != 0) {
+		printf("Error %i from TCGETS2: %s\n", errno, strerror(errno));
+		return 1;
+	}
+
+	tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+	tio.c_ispeed = baudrate;
+	tio.c_ospeed = baudrate;
+
+	if (ioctl(fd, TCSETS2, &tio) != 0) {
+		printf("Error %i from TCSETS2: %s\n", errno, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+int serial_get_baudrate(int fd, int *baudrate)
+{
+	struct termios2 tio;
+
+	if (ioctl(fd, TCGETS2, &tio) != 0) {
+		printf("Error %i from TCGETS2: %s\n", errno, strerror(errno));
+		return 1;
+	}
+	*baudrate = tio.c_ospeed;
+
+	return 0;
+}
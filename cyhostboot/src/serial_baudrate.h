@@ -0,0 +1,15 @@
+#ifndef __SERIAL_BAUDRATE_H__
+#define __SERIAL_BAUDRATE_H__
+
+/**
+ * Set an arbitrary baudrate on a serial port using the Linux termios2
+ * interface. Other port settings are left untouched.
+ */
+int serial_set_custom_baudrate(int fd, int baudrate);
+
+/**
+ * Get the output baudrate the driver actually configured
+ */
+int serial_get_baudrate(int fd, int *baudrate);
+
+#endif
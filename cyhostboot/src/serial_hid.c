@@ -0,0 +1,146 @@
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include "cyhostboot.h"
+#include "serial_hid.h"
+
+#define HIDRAW_CLASS_PATH	"/sys/class/hidraw"
+
+int serial_is_hid(const char *name)
+{
+	return strncmp(name, SERIAL_HID_PREFIX, strlen(SERIAL_HID_PREFIX)) == 0;
+}
+
+/* Parse VID:PID[:serial], return 1 if the name is not valid */
+static int hid_parse_name(const char *name, unsigned int *vid, unsigned int *pid, const char **serial)
+{
+	char *end;
+
+	name += strlen(SERIAL_HID_PREFIX);
+	*vid = strtoul(name, &end, 16);
+	if (end == name || *end != ':' || *vid > 0xffff)
+		return 1;
+	name = end + 1;
+	*pid = strtoul(name, &end, 16);
+	if (end == name || (*end && *end != ':') || *pid > 0xffff)
+		return 1;
+	*serial = *end ? end + 1 : NULL;
+
+	return 0;
+}
+
+/* Check the ids and serial number of a hidraw device against the port ones */
+static int hid_match(const char *dev, unsigned int vid, unsigned int pid, const char *serial)
+{
+	char path[PATH_MAX], line[256];
+	unsigned int bus, dev_vid, dev_pid;
+	int ids = 0, serial_ok = !serial;
+	FILE *file;
+
+	snprintf(path, sizeof(path), HIDRAW_CLASS_PATH "/%s/device/uevent", dev);
+	file = fopen(path, "r");
+	if (!file)
+		return 0;
+	while (fgets(line, sizeof(line), file)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (sscanf(line, "HID_ID=%x:%x:%x", &bus, &dev_vid, &dev_pid) == 3)
+			ids = dev_vid == vid && dev_pid == pid;
+		else if (serial && strncmp(line, "HID_UNIQ=", 9) == 0)
+			serial_ok = strcmp(line + 9, serial) == 0;
+	}
+	fclose(file);
+
+	return ids && serial_ok;
+}
+
+int serial_hid_open(struct serial_port *port)
+{
+	unsigned int vid, pid;
+	const char *serial;
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+
+	if (hid_parse_name(port->name, &vid, &pid, &serial)) {
+		printf("Invalid HID port %s, expected hid:VID:PID[:serial]\n", port->name);
+		return 1;
+	}
+
+	dir = opendir(HIDRAW_CLASS_PATH);
+	while (dir && (entry = readdir(dir))) {
+		if (strncmp(entry->d_name, "hidraw", 6) || !hid_match(entry->d_name, vid, pid, serial))
+			continue;
+		snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
+		closedir(dir);
+
+		port->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (port->fd < 0) {
+			printf("Failed to open %s: %s\n", path, strerror(errno));
+			return 1;
+		}
+		dbg_printf("Using %s for %s\n", path, port->name);
+		return 0;
+	}
+	if (dir)
+		closedir(dir);
+	printf("No HID device %04x:%04x%s%s found\n", vid, pid, serial ? " with serial " : "",
+	       serial ? serial : "");
+
+	return 1;
+}
+
+int serial_hid_write(struct serial_port *port, const unsigned char *bytes, int size)
+{
+	/* Report number 0, the bootloader does not number its reports */
+	unsigned char report[1 + SERIAL_HID_REPORT_SIZE] = {0};
+	ssize_t ret;
+
+	if (size > SERIAL_HID_REPORT_SIZE) {
+		printf("Packet too large for a HID report (%d bytes)\n", size);
+		return 1;
+	}
+	memcpy(report + 1, bytes, size);
+
+	do {
+		ret = write(port->fd, report, sizeof(report));
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0 && errno == EAGAIN)
+		return CYRET_AGAIN;
+	if (ret < 0) {
+		printf("Error when writing report: %s\n", strerror(errno));
+		return 1;
+	}
+
+	return CYRET_SUCCESS;
+}
+
+int serial_hid_read_report(struct serial_port *port, unsigned char *report)
+{
+	ssize_t ret;
+
+	do {
+		ret = read(port->fd, report, SERIAL_HID_REPORT_SIZE);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0 && errno == EAGAIN)
+		return 0;
+	if (ret < 0) {
+		printf("Read error: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return ret;
+}
+
+void serial_hid_flush(struct serial_port *port)
+{
+	unsigned char report[SERIAL_HID_REPORT_SIZE];
+
+	while (serial_hid_read_report(port, report) > 0)
+		;
+}
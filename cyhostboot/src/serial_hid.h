@@ -0,0 +1,42 @@
+#ifndef __SERIAL_HID_H__
+#define __SERIAL_HID_H__
+
+#include "serial.h"
+
+/* Prefix of the USB HID bootloaders */
+#define SERIAL_HID_PREFIX	"hid:"
+/* Size of the input and output reports of the bootloader */
+#define SERIAL_HID_REPORT_SIZE	64
+
+/**
+ * A PSoC USB HID bootloader is named hid:VID:PID[:serial], in hexadecimal as
+ * shown by lsusb, and reached through its hidraw device. Each packet is sent
+ * in a single output report padded to 64 bytes, so packets can not be bigger.
+ * The write returns once the report is sent on the interrupt endpoint, which
+ * paces the packets sent back to back (a sync and the packet after it). A
+ * response comes in as many input reports as needed, the padding of the last
+ * one is dropped.
+ */
+int serial_is_hid(const char *name);
+
+/**
+ * Find the hidraw device of a port and open it as the port file descriptor
+ */
+int serial_hid_open(struct serial_port *port);
+
+/**
+ * Send a packet in an output report, CYRET_AGAIN if it can not be sent yet
+ */
+int serial_hid_write(struct serial_port *port, const unsigned char *bytes, int size);
+
+/**
+ * Read an input report, return its size, 0 if none is there or -1 on error
+ */
+int serial_hid_read_report(struct serial_port *port, unsigned char *report);
+
+/**
+ * Drop the input reports received and not read yet
+ */
+void serial_hid_flush(struct serial_port *port);
+
+#endif
@@ -0,0 +1,146 @@
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <termios.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+#include "serial_latency.h"
+
+/* Latency timer of FTDI style adapters, in milliseconds */
+#define LATENCY_TIMER_PATH	"/sys/class/tty/%s/device/latency_timer"
+#define LOW_LATENCY_TIMER	1
+/* VMIN is a single byte */
+#define VMIN_MAX		255
+
+static int latency_timer_path(struct serial_port *port, char *path, size_t size)
+{
+	char real[PATH_MAX];
+	const char *name;
+
+	/* The port may be a link to the tty device */
+	if (!realpath(port->name, real))
+		return 1;
+	name = strrchr(real, '/');
+	snprintf(path, size, LATENCY_TIMER_PATH, name ? name + 1 : real);
+
+	return 0;
+}
+
+static int latency_timer_read(const char *path)
+{
+	FILE *file;
+	int ms;
+
+	file = fopen(path, "r");
+	if (!file)
+		return 0;
+	if (fscanf(file, "%d", &ms) != 1)
+		ms = 0;
+	fclose(file);
+
+	return ms;
+}
+
+static int latency_timer_write(const char *path, int ms)
+{
+	FILE *file;
+	int ret;
+
+	file = fopen(path, "w");
+	if (!file)
+		return 1;
+	ret = fprintf(file, "%d\n", ms) < 0;
+	ret |= fclose(file) != 0;
+
+	return ret;
+}
+
+static int serial_set_async_low_latency(struct serial_port *port, int enable)
+{
+	struct serial_struct serinfo;
+
+	if (ioctl(port->fd, TIOCGSERIAL, &serinfo) != 0)
+		return 1;
+	if (enable)
+		serinfo.flags |= ASYNC_LOW_LATENCY;
+	else
+		serinfo.flags &= ~ASYNC_LOW_LATENCY;
+
+	return ioctl(port->fd, TIOCSSERIAL, &serinfo) != 0;
+}
+
+void serial_set_low_latency(struct serial_port *port)
+{
+	struct serial_struct serinfo;
+	char path[PATH_MAX + 64];
+	char flag_str[64], timer_str[64];
+	int timer;
+
+	if (ioctl(port->fd, TIOCGSERIAL, &serinfo) != 0) {
+		snprintf(flag_str, sizeof(flag_str), "not supported");
+	} else if (serinfo.flags & ASYNC_LOW_LATENCY) {
+		snprintf(flag_str, sizeof(flag_str), "on (was on)");
+	} else if (serial_set_async_low_latency(port, 1)) {
+		snprintf(flag_str, sizeof(flag_str), "off (%s)", strerror(errno));
+	} else {
+		port->async_low_latency_set = 1;
+		snprintf(flag_str, sizeof(flag_str), "on (was off)");
+	}
+
+	timer = 0;
+	if (!latency_timer_path(port, path, sizeof(path)))
+		timer = latency_timer_read(path);
+	if (!timer) {
+		snprintf(timer_str, sizeof(timer_str), "none");
+	} else if (timer <= LOW_LATENCY_TIMER) {
+		snprintf(timer_str, sizeof(timer_str), "%d ms (was %d ms)", timer, timer);
+	} else if (latency_timer_write(path, LOW_LATENCY_TIMER)) {
+		snprintf(timer_str, sizeof(timer_str), "%d ms (%s)", timer, strerror(errno));
+	} else {
+		port->saved_latency_timer = timer;
+		snprintf(timer_str, sizeof(timer_str), "%d ms (was %d ms)", LOW_LATENCY_TIMER, timer);
+	}
+
+	/* The port is opened again for each action, report the settings once */
+	if (!port->latency_reported)
+		printf("%s: low latency flag %s, latency timer %s\n", port->name, flag_str, timer_str);
+	port->latency_reported = 1;
+}
+
+void serial_restore_latency(struct serial_port *port)
+{
+	char path[PATH_MAX + 64];
+
+	if (port->async_low_latency_set)
+		serial_set_async_low_latency(port, 0);
+	port->async_low_latency_set = 0;
+
+	if (port->saved_latency_timer && !latency_timer_path(port, path, sizeof(path)))
+		latency_timer_write(path, port->saved_latency_timer);
+	port->saved_latency_timer = 0;
+}
+
+int serial_set_vmin(struct serial_port *port, int count)
+{
+	struct termios tio;
+
+	if (count < 1)
+		count = 1;
+	else if (count > VMIN_MAX)
+		count = VMIN_MAX;
+	if (count == port->vmin)
+		return 0;
+
+	if (tcgetattr(port->fd, &tio) != 0)
+		return 1;
+	tio.c_cc[VMIN] = count;
+	tio.c_cc[VTIME] = 0;
+	if (tcsetattr(port->fd, TCSANOW, &tio) != 0)
+		return 1;
+	port->vmin = count;
+
+	return 0;
+}
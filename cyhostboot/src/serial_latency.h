@@ -0,0 +1,27 @@
+#ifndef __SERIAL_LATENCY_H__
+#define __SERIAL_LATENCY_H__
+
+#include "serial.h"
+
+/**
+ * USB serial drivers and adapters hold received bytes back to batch them,
+ * which delays every response of the bootloader by up to the latency timer
+ * of FTDI style adapters (16ms by default). Enable the low latency mode of
+ * the driver and lower the latency timer when the adapter has one, and report
+ * the settings before and after the first time. Settings that can not be
+ * changed are left alone.
+ */
+void serial_set_low_latency(struct serial_port *port);
+
+/**
+ * Restore the settings changed by serial_set_low_latency()
+ */
+void serial_restore_latency(struct serial_port *port);
+
+/**
+ * Only wake up a reader polling the port once count bytes are received,
+ * so that a response is read at once instead of in pieces
+ */
+int serial_set_vmin(struct serial_port *port, int count);
+
+#endif
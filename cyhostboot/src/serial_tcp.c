@@ -0,0 +1,133 @@
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "serial_tcp.h"
+
+/* Time allowed to connect to each address of the server, in milliseconds */
+#define TCP_CONNECT_TIMEOUT	5000
+
+int serial_is_tcp(const char *name)
+{
+	return strncmp(name, SERIAL_TCP_PREFIX, strlen(SERIAL_TCP_PREFIX)) == 0;
+}
+
+/* Split host:port or [host]:port, return 1 if the name is not valid */
+static int tcp_parse_name(const char *name, char *host, size_t size, const char **service)
+{
+	const char *end;
+	size_t len;
+
+	name += strlen(SERIAL_TCP_PREFIX);
+	if (*name == '[') {
+		name++;
+		end = strchr(name, ']');
+		if (!end || end[1] != ':')
+			return 1;
+		*service = end + 2;
+	} else {
+		end = strrchr(name, ':');
+		if (!end)
+			return 1;
+		*service = end + 1;
+	}
+
+	len = end - name;
+	if (!len || len >= size || !**service)
+		return 1;
+	memcpy(host, name, len);
+	host[len] = '\0';
+
+	return 0;
+}
+
+static int tcp_connect_addr(const struct addrinfo *ai)
+{
+	struct pollfd pfd;
+	socklen_t len = sizeof(int);
+	int fd, err, ret;
+
+	fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+	if (fd < 0)
+		return -errno;
+
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+		return fd;
+	if (errno != EINPROGRESS) {
+		err = -errno;
+		goto err;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	do {
+		ret = poll(&pfd, 1, TCP_CONNECT_TIMEOUT);
+	} while (ret < 0 && errno == EINTR);
+	if (ret <= 0) {
+		err = ret ? -errno : -ETIMEDOUT;
+		goto err;
+	}
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+		err = -err;
+		goto err;
+	}
+
+	return fd;
+
+err:
+	close(fd);
+	return err;
+}
+
+int serial_tcp_connect(struct serial_port *port)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *service;
+	int fd = -ECONNREFUSED, on = 1, ret;
+
+	if (tcp_parse_name(port->name, host, sizeof(host), &service)) {
+		printf("Invalid TCP serial port %s, expected tcp://host:port\n", port->name);
+		return 1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	ret = getaddrinfo(host, service, &hints, &res);
+	if (ret) {
+		printf("Failed to resolve %s: %s\n", host, gai_strerror(ret));
+		return 1;
+	}
+	/* Try each address of the server in turn */
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = tcp_connect_addr(ai);
+		if (fd >= 0)
+			break;
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		printf("Failed to connect to %s: %s\n", port->name + strlen(SERIAL_TCP_PREFIX), strerror(-fd));
+		return 1;
+	}
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)))
+		printf("Failed to disable Nagle's algorithm: %s\n", strerror(errno));
+	port->fd = fd;
+
+	return 0;
+}
+
+void serial_tcp_flush(struct serial_port *port)
+{
+	unsigned char buf[256];
+
+	while (recv(port->fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		;
+}
@@ -0,0 +1,30 @@
+#ifndef __SERIAL_TCP_H__
+#define __SERIAL_TCP_H__
+
+#include "serial.h"
+
+/* Prefix of the serial ports reached over TCP */
+#define SERIAL_TCP_PREFIX	"tcp://"
+
+/**
+ * A serial port shared by a serial server (ser2net, socat, an Ethernet to
+ * serial bridge...) in raw mode is named tcp://host:port, with IPv6 addresses
+ * in brackets. The line settings are the ones of the server. Nagle's
+ * algorithm is disabled so that each packet leaves in a single segment as
+ * soon as it is sent, instead of waiting for the acknowledgement of the
+ * previous one, and responses are framed from the byte stream as on a tty.
+ */
+int serial_is_tcp(const char *name);
+
+/**
+ * Connect to the server of a port, set its non-blocking socket as the port
+ * file descriptor
+ */
+int serial_tcp_connect(struct serial_port *port);
+
+/**
+ * Drop the bytes received and not read yet
+ */
+void serial_tcp_flush(struct serial_port *port);
+
+#endif
@@ -0,0 +1,146 @@
+#include <string.h>
+#include <time.h>
+
+#include <cybtldr_command.h>
+
+#include "trace.h"
+
+/* All the ports are shown in the same process */
+#define TRACE_PID	1
+
+unsigned long long trace_now(void)
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+/* Timestamps and durations are in microseconds in the trace */
+static double trace_us(unsigned long long ns)
+{
+	return ns / 1000.0;
+}
+
+int trace_open(struct trace *trace, const char *path)
+{
+	memset(trace, 0, sizeof(*trace));
+	trace->file = fopen(path, "w");
+	if (!trace->file)
+		return 1;
+
+	trace->origin = trace_now();
+	fprintf(trace->file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+	return 0;
+}
+
+void trace_close(struct trace *trace)
+{
+	fprintf(trace->file, "\n]}\n");
+	fclose(trace->file);
+}
+
+/* Write a JSON string, names come from the command line and may hold quotes,
+ * backslashes or control characters */
+static void trace_write_string(FILE *file, const char *str)
+{
+	const unsigned char *c;
+
+	fputc('"', file);
+	for (c = (const unsigned char *)str; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(file, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(file, "\\u%04x", *c);
+		else
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+/* Must be called with the trace locked */
+static void trace_event_start(struct trace *trace, const char *name, const char *ph, int id)
+{
+	fprintf(trace->file, "%s\n{\"name\": ", trace->events++ ? "," : "");
+	trace_write_string(trace->file, name);
+	fprintf(trace->file, ", \"ph\": ");
+	trace_write_string(trace->file, ph);
+	fprintf(trace->file, ", \"pid\": %d, \"tid\": %d", TRACE_PID, id);
+}
+
+static void trace_span(struct trace *trace, const char *name, int id,
+		       unsigned long long start, unsigned long long end)
+{
+	trace_event_start(trace, name, "X", id);
+	fprintf(trace->file, ", \"ts\": %.3f, \"dur\": %.3f}",
+		trace_us(start - trace->origin), trace_us(end - start));
+}
+
+void trace_name_port(struct trace *trace, int id, const char *name)
+{
+	trace_event_start(trace, "thread_name", "M", id);
+	fprintf(trace->file, ", \"args\": {\"name\": ");
+	trace_write_string(trace->file, name);
+	fprintf(trace->file, "}}");
+}
+
+void trace_transfer_start(struct trace_transfer *transfer, const unsigned char *packet, int size)
+{
+	memset(transfer, 0, sizeof(*transfer));
+	transfer->cmd = packet[1];
+	transfer->array_id = -1;
+	transfer->row_num = -1;
+	transfer->written = size;
+	transfer->write_start = trace_now();
+
+	switch (transfer->cmd) {
+	case CMD_ERASE_ROW:
+	case CMD_PROGRAM_ROW:
+	case CMD_VERIFY_ROW:
+		if (size >= BASE_CMD_SIZE + 3) {
+			transfer->array_id = packet[4];
+			transfer->row_num = packet[5] | (packet[6] << 8);
+		}
+		break;
+	}
+}
+
+void trace_transfer_end(struct trace *trace, int id, struct trace_transfer *transfer)
+{
+	unsigned long long end;
+
+	/* A failed command ends now, one without response once written, or now
+	 * if the end of its write is not known yet */
+	if (transfer->last_byte)
+		end = transfer->last_byte;
+	else if (transfer->failed || !transfer->write_end)
+		end = trace_now();
+	else
+		end = transfer->write_end;
+
+	trace_event_start(trace, CyBtldr_GetCommandName(transfer->cmd), "X", id);
+	fprintf(trace->file, ", \"cat\": \"command\", \"ts\": %.3f, \"dur\": %.3f, "
+		"\"args\": {\"cmd\": \"0x%02x\", \"written\": %d, \"read\": %d",
+		trace_us(transfer->write_start - trace->origin), trace_us(end - transfer->write_start),
+		transfer->cmd, transfer->written, transfer->read);
+	if (transfer->array_id >= 0)
+		fprintf(trace->file, ", \"array_id\": %d, \"row_num\": %d",
+			transfer->array_id, transfer->row_num);
+	if (transfer->first_byte)
+		fprintf(trace->file, ", \"first_byte_us\": %.3f",
+			trace_us(transfer->first_byte - transfer->write_start));
+	if (transfer->failed)
+		fprintf(trace->file, ", \"failed\": true");
+	fprintf(trace->file, "}}");
+
+	/* Steps of the command, nested under it in the timeline */
+	if (transfer->write_end)
+		trace_span(trace, "write", id, transfer->write_start, transfer->write_end);
+	if (transfer->write_end && transfer->first_byte)
+		trace_span(trace, "wait", id, transfer->write_end, transfer->first_byte);
+	if (transfer->first_byte && transfer->last_byte)
+		trace_span(trace, "receive", id, transfer->first_byte, transfer->last_byte);
+
+	memset(transfer, 0, sizeof(*transfer));
+}
@@ -0,0 +1,57 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+
+/**
+ * A timeline of the commands sent to the bootloaders, written in the Chrome
+ * trace event format (chrome://tracing, Perfetto). Each serial port is shown
+ * as its own thread. The trace can be shared by several ports driven from the
+ * same thread.
+ */
+struct trace {
+	FILE *file;
+	/* Time of the start of the trace, in nanoseconds */
+	unsigned long long origin;
+	int events;
+};
+
+/**
+ * A single command sent and its response, timestamps are in nanoseconds from
+ * trace_now(). Timestamps of steps that did not happen are 0.
+ */
+struct trace_transfer {
+	unsigned char cmd;
+	/* Array and row of row commands, -1 otherwise */
+	int array_id;
+	int row_num;
+	int written;
+	int read;
+	int failed;
+	unsigned long long write_start;
+	unsigned long long write_end;
+	unsigned long long first_byte;
+	unsigned long long last_byte;
+};
+
+unsigned long long trace_now(void);
+
+int trace_open(struct trace *trace, const char *path);
+void trace_close(struct trace *trace);
+
+/**
+ * Name the timeline of a serial port
+ */
+void trace_name_port(struct trace *trace, int id, const char *name);
+
+/**
+ * Start recording a command from the packet being written
+ */
+void trace_transfer_start(struct trace_transfer *transfer, const unsigned char *packet, int size);
+
+/**
+ * Write the events of a command to the trace
+ */
+void trace_transfer_end(struct trace *trace, int id, struct trace_transfer *transfer);
+
+#endif
@@ -0,0 +1,169 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		       unsigned int flags, void *arg, size_t size)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, size);
+}
+
+int uring_init(struct uring *ring, unsigned int entries)
+{
+	struct io_uring_params params;
+	size_t sq_size, cq_size;
+	int ret;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&params, 0, sizeof(params));
+	ring->fd = uring_setup(entries, &params);
+	if (ring->fd < 0)
+		return -errno;
+
+	/* Waiting with a timeout needs the extended arguments of io_uring_enter
+	 * (Linux 5.11), requests completing silently need Linux 5.17, and both
+	 * rings are then always mapped at once */
+	if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_CQE_SKIP) ||
+	    !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		close(ring->fd);
+		return -EOPNOTSUPP;
+	}
+
+	sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+	ring->ring_mem = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			      ring->fd, IORING_OFF_SQ_RING);
+	if (ring->ring_mem == MAP_FAILED)
+		goto err;
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes_mem = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			      ring->fd, IORING_OFF_SQES);
+	if (ring->sqes_mem == MAP_FAILED) {
+		munmap(ring->ring_mem, ring->ring_size);
+		goto err;
+	}
+
+	ring->sq_head = (unsigned int *)((char *)ring->ring_mem + params.sq_off.head);
+	ring->sq_tail = (unsigned int *)((char *)ring->ring_mem + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *)((char *)ring->ring_mem + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)((char *)ring->ring_mem + params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+	ring->sqes = ring->sqes_mem;
+	ring->cq_head = (unsigned int *)((char *)ring->ring_mem + params.cq_off.head);
+	ring->cq_tail = (unsigned int *)((char *)ring->ring_mem + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *)((char *)ring->ring_mem + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->ring_mem + params.cq_off.cqes);
+
+	return 0;
+
+err:
+	ret = -errno;
+	close(ring->fd);
+	return ret;
+}
+
+void uring_exit(struct uring *ring)
+{
+	munmap(ring->sqes_mem, ring->sqes_size);
+	munmap(ring->ring_mem, ring->ring_size);
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+/* Make the entries filled so far visible to the kernel, return the number
+ * of entries it has not consumed yet */
+static unsigned int uring_flush(struct uring *ring)
+{
+	unsigned int tail = *ring->sq_tail + ring->sq_pending;
+
+	if (ring->sq_pending)
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+	ring->sq_pending = 0;
+
+	return tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+int uring_submit(struct uring *ring)
+{
+	int ret;
+
+	ret = uring_enter(ring->fd, uring_flush(ring), 0, 0, NULL, 0);
+
+	return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *ring->sq_tail + ring->sq_pending;
+	unsigned int index;
+
+	if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+		if (uring_submit(ring) < 0)
+			return NULL;
+		tail = *ring->sq_tail;
+		if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+			return NULL;
+	}
+
+	index = tail & *ring->sq_mask;
+	ring->sq_array[index] = index;
+	ring->sq_pending++;
+	sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+struct io_uring_sqe *uring_last_sqe(struct uring *ring)
+{
+	if (!ring->sq_pending)
+		return NULL;
+
+	return &ring->sqes[(*ring->sq_tail + ring->sq_pending - 1) & *ring->sq_mask];
+}
+
+int uring_submit_and_wait(struct uring *ring, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	int ret;
+
+	memset(&arg, 0, sizeof(arg));
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000LL;
+		arg.ts = (unsigned long)&ts;
+	}
+
+	ret = uring_enter(ring->fd, uring_flush(ring), 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			  &arg, sizeof(arg));
+
+	return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring)
+{
+	unsigned int head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
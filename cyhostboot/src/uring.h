@@ -0,0 +1,75 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/**
+ * A minimal io_uring instance, set up through the raw system calls so that
+ * no library is needed. Submission queue entries are filled with
+ * uring_get_sqe(), then submitted along with the wait for completions by a
+ * single uring_submit_and_wait() call.
+ */
+struct uring {
+	int fd;
+	/* Submission queue, with the entries not submitted yet */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int sq_entries;
+	unsigned int sq_pending;
+	struct io_uring_sqe *sqes;
+	/* Completion queue */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* Mappings of the rings and of the submission queue entries */
+	void *ring_mem;
+	size_t ring_size;
+	void *sqes_mem;
+	size_t sqes_size;
+};
+
+/**
+ * Set up an io_uring with at least entries submission queue entries, return
+ * 0 or a negative errno if io_uring can not be used (old kernel, disabled
+ * by the administrator or by a seccomp filter).
+ */
+int uring_init(struct uring *ring, unsigned int entries);
+void uring_exit(struct uring *ring);
+
+/**
+ * Return a cleared submission queue entry, submitting the pending ones
+ * first if the queue is full
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/**
+ * Return the last entry returned by uring_get_sqe() if it is not submitted
+ * yet, so that it can be linked to the next one
+ */
+struct io_uring_sqe *uring_last_sqe(struct uring *ring);
+
+/**
+ * Submit the pending entries without waiting, return the number of entries
+ * submitted or a negative errno
+ */
+int uring_submit(struct uring *ring);
+
+/**
+ * Submit the pending entries and wait for at least one completion or the
+ * timeout in milliseconds (-1 for none), return the number of entries
+ * submitted or a negative errno (-ETIME on timeout)
+ */
+int uring_submit_and_wait(struct uring *ring, int timeout);
+
+/**
+ * Return the next completion, or NULL if there is none, and mark it as seen
+ * once handled
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+void uring_cqe_seen(struct uring *ring);
+
+#endif
@@ -0,0 +1,47 @@
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "ihex2cyacd_cmdline.h"
+int ihex2cyacd_cmdline_parser(int argc, char **argv, struct ihex2cyacd_args_info *a)
+{
+  memset(a, 0, sizeof(*a));
+  a->cpu_arg = strdup("CY8C42");
+  static struct option lo[] = {
+    {"input", 1, 0, 1000},
+    {"bootloader_size", 1, 0, 1001},
+    {"output", 1, 0, 1002},
+    {"cpu", 1, 0, 1003},
+    {0,0,0,0}};
+  int ch;
+  while ((ch = getopt_long(argc, argv, "i:b:o:c:", lo, NULL)) != -1) {
+    switch (ch) {
+    case 1000: case 'i':
+      a->input_given++;
+      if (optarg) a->input_arg = strdup(optarg);
+      a->input_orig = optarg;
+      break;
+    case 1001: case 'b':
+      a->bootloader_size_given++;
+      if (optarg) a->bootloader_size_arg = atoi(optarg);
+      a->bootloader_size_orig = optarg;
+      break;
+    case 1002: case 'o':
+      a->output_given++;
+      if (optarg) a->output_arg = strdup(optarg);
+      a->output_orig = optarg;
+      break;
+    case 1003: case 'c':
+      a->cpu_given++;
+      if (optarg) a->cpu_arg = strdup(optarg);
+      a->cpu_orig = optarg;
+      break;
+    default: return 1;
+    }
+  }
+  if (!a->input_given) { fprintf(stderr, "missing --input\n"); return 1; }
+  if (!a->bootloader_size_given) { fprintf(stderr, "missing --bootloader_size\n"); return 1; }
+  if (!a->output_given) { fprintf(stderr, "missing --output\n"); return 1; }
+  a->inputs = argv + optind; a->inputs_num = argc - optind;
+  return 0;
+}
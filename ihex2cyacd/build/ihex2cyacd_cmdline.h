@@ -0,0 +1,23 @@
+#ifndef MINI_IHEX2CYACD_CMDLINE_H
+#define MINI_IHEX2CYACD_CMDLINE_H
+#ifndef CMDLINE_PARSER_PACKAGE
+#define CMDLINE_PARSER_PACKAGE "x"
+#endif
+struct ihex2cyacd_args_info {
+  char * input_arg;
+  char * input_orig;
+  unsigned int input_given;
+  int bootloader_size_arg;
+  char * bootloader_size_orig;
+  unsigned int bootloader_size_given;
+  char * output_arg;
+  char * output_orig;
+  unsigned int output_given;
+  char * cpu_arg;
+  char * cpu_orig;
+  unsigned int cpu_given;
+  char **inputs;
+  unsigned inputs_num;
+};
+int ihex2cyacd_cmdline_parser(int argc, char **argv, struct ihex2cyacd_args_info *args_info);
+#endif